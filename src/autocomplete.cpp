@@ -1,14 +1,15 @@
 #include "autocomplete.h"
 #include "document.h"
+#include "executor.h"
 
 #include <core/text-buffer.h>
-#include <pthread.h>
 
 #define AUTOCOMPLETE_TTL 32
 
 AutoComplete::AutoComplete(std::u16string p)
-    : prefix(p), state(State::Loading), snapshot(0), document(0), selected(0),
-      ttl(AUTOCOMPLETE_TTL) {}
+    : prefix(p), state(State::Loading), snapshot(0), document(0),
+      indexed(false), generation(0), selected(0), ttl(AUTOCOMPLETE_TTL),
+      cancelled(false) {}
 
 AutoComplete::~AutoComplete() {
   if (snapshot) {
@@ -16,6 +17,21 @@ AutoComplete::~AutoComplete() {
   }
 }
 
+void AutoComplete::cancel() { cancelled = true; }
+
+// the job may still be queued or running and keeps the object alive; the
+// snapshot must go while the document's buffer does, once the job is done
+// with it
+void AutoComplete::release() {
+  cancel();
+  std::lock_guard<std::mutex> lock(mutex);
+  if (snapshot) {
+    delete snapshot;
+    snapshot = 0;
+  }
+  document = 0;
+}
+
 void AutoComplete::set_ready() { state = AutoComplete::State::Ready; }
 
 void AutoComplete::set_consumed() { state = AutoComplete::State::Consumed; }
@@ -31,38 +47,106 @@ bool AutoComplete::is_disposable() {
 
 #include "utf8.h"
 #include "util.h"
+#include "words.h"
+
+#include <unordered_set>
 
 void *autocomplete_thread(void *arg) {
   AutoComplete *autocomplete = (AutoComplete *)arg;
-  Document *doc = autocomplete->document;
+  std::lock_guard<std::mutex> lock(autocomplete->mutex);
+  if (autocomplete->cancelled || !autocomplete->snapshot) {
+    return NULL;
+  }
   TextBuffer::Snapshot *snapshot = autocomplete->snapshot;
 
   std::u16string k = autocomplete->prefix;
 
   // log("%s", u16string_to_string(k).c_str());
 
-  std::vector<TextBuffer::SubsequenceMatch> res =
-      snapshot->find_words_with_subsequence_in_range(k, k,
-                                                     Range::all_inclusive());
-  for (auto r : res) {
-    if (r.score < 0)
-      break;
-    if (r.word == k)
-      continue;
-    autocomplete->matches.push_back(AutoComplete::Match{r.word, r.score});
-    if (autocomplete->matches.size() > 20)
-      break;
+  FuzzyQuery query(k);
+  FuzzyTopK top(AUTOCOMPLETE_MATCHES);
+  std::unordered_set<std::u16string> seen;
+  std::vector<Range> words;
+  uint32_t rows = snapshot->extent().row + 1;
+  for (uint32_t row = 0; row < rows && !autocomplete->cancelled; row++) {
+    std::u16string line = snapshot->line_for_row(row);
+    words.clear();
+    tokenize_words(line.data(), line.size(), row, words);
+    for (auto &w : words) {
+      const char16_t *word = line.data() + w.start.column;
+      size_t length = w.end.column - w.start.column;
+      int score = query.score(word, length);
+      if (!top.accepts(score)) {
+        continue;
+      }
+      std::u16string text(word, length);
+      if (text != k && seen.insert(text).second) {
+        top.push(text, score);
+      }
+    }
+  }
+  // a superseded scan stopped part way, its matches are dropped
+  if (autocomplete->cancelled) {
+    return NULL;
+  }
+  for (auto &m : top.take()) {
+    autocomplete->matches.push_back(AutoComplete::Match{m.text, m.score});
   }
+  return NULL;
+}
 
-  autocomplete->thread_id = 0;
-  autocomplete->set_ready();
+void AutoComplete::run(AutoCompletePtr autocomplete) {
+  Executor::instance()->submit(
+      [autocomplete] {
+        autocomplete_thread(autocomplete.get());
+        // the snapshot belongs to the ui thread and is dropped there
+        Executor::instance()->publish([autocomplete] {
+          delete autocomplete->snapshot;
+          autocomplete->snapshot = NULL;
+          autocomplete->set_ready();
+        });
+      },
+      Executor::Interactive);
+}
 
-  delete autocomplete->snapshot;
-  autocomplete->snapshot = NULL;
-  return NULL;
+// answers from the completion index, re-scoring the candidates of a ready
+// ancestor prefix if there is one
+static void autocomplete_index_thread(AutoComplete *autocomplete,
+                                      AutoComplete *ancestor) {
+  if (autocomplete->cancelled) {
+    return;
+  }
+  CompletionIndex *completions = CompletionIndex::instance();
+  bool refined = ancestor &&
+                 completions->refine(autocomplete->prefix, ancestor->candidates,
+                                     ancestor->generation,
+                                     autocomplete->candidates,
+                                     &autocomplete->cancelled);
+  if (!refined) {
+    autocomplete->candidates =
+        completions->query(autocomplete->prefix, &autocomplete->cancelled);
+  }
+  if (autocomplete->cancelled) {
+    autocomplete->candidates.clear();
+    return;
+  }
+
+  FuzzyTopK top(AUTOCOMPLETE_MATCHES);
+  for (auto &m : autocomplete->candidates) {
+    top.push(m.text, m.score);
+  }
+  for (auto &m : top.take()) {
+    autocomplete->matches.push_back(AutoComplete::Match{m.text, m.score});
+  }
 }
 
-void AutoComplete::run(AutoComplete *autocomplete) {
-  pthread_create((pthread_t *)&(autocomplete->thread_id), NULL,
-                 &autocomplete_thread, (void *)(autocomplete));
+void AutoComplete::run_indexed(AutoCompletePtr autocomplete,
+                               AutoCompletePtr ancestor) {
+  Executor::instance()->submit(
+      [autocomplete, ancestor] {
+        autocomplete_index_thread(autocomplete.get(), ancestor.get());
+        Executor::instance()->publish(
+            [autocomplete] { autocomplete->set_ready(); });
+      },
+      Executor::Interactive);
 }
@@ -1,10 +1,16 @@
 #ifndef TE_AUTOCOMPLETE_H
 #define TE_AUTOCOMPLETE_H
 
+#include <atomic>
 #include <core/text-buffer.h>
 #include <memory>
+#include <mutex>
 #include <string>
 
+#include "wordindex.h"
+
+#define AUTOCOMPLETE_MATCHES 20
+
 class Document;
 class AutoComplete {
 public:
@@ -25,11 +31,23 @@ public:
   };
 
   std::vector<Match> matches;
+  // every word matching prefix when answered from the word index, valid
+  // while the index is at the same generation
+  std::vector<FuzzyMatch> candidates;
+  bool indexed;
+  unsigned generation;
   int selected;
   int ttl;
-  long thread_id;
-
-  static void run(AutoComplete *autocomplete);
+  // set when a newer prefix supersedes this request
+  std::atomic<bool> cancelled;
+  // held by the job while it reads the snapshot
+  std::mutex mutex;
+
+  static void run(std::shared_ptr<AutoComplete> autocomplete);
+  static void run_indexed(std::shared_ptr<AutoComplete> autocomplete,
+                          std::shared_ptr<AutoComplete> ancestor);
+  void cancel();
+  void release();
   void set_ready();
   void set_consumed();
   void keep_alive();
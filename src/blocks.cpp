@@ -0,0 +1,270 @@
+#include "blocks.h"
+#include "document.h"
+
+#include <functional>
+
+#define BLOCK_CHUNK_SIZE 256
+
+Block::Block()
+    : block_data_t(), line(0), line_height(1), line_length(0), dirty(true),
+      has_words(false) {}
+
+void Block::make_dirty() {
+  dirty = true;
+  words.clear();
+  has_words = false;
+  brackets.clear();
+  line_height = 1;
+  line_length = 0;
+}
+
+static int node_size(BlockNode *node) { return node ? node->size : 0; }
+
+static void update_node(BlockNode *node) {
+  node->size =
+      node_size(node->left) + node->chunk.count + node_size(node->right);
+}
+
+static void delete_nodes(BlockNode *node) {
+  if (!node) {
+    return;
+  }
+  delete_nodes(node->left);
+  delete_nodes(node->right);
+  delete node;
+}
+
+static void walk_nodes(BlockNode *node,
+                       std::function<void(BlockNode *)> callback) {
+  if (!node) {
+    return;
+  }
+  walk_nodes(node->left, callback);
+  callback(node);
+  walk_nodes(node->right, callback);
+}
+
+BlockList::BlockList() : root(nullptr), seed(0x9e3779b9) {}
+
+BlockList::~BlockList() { delete_nodes(root); }
+
+int BlockList::size() { return node_size(root); }
+
+int BlockList::materialized() {
+  int res = 0;
+  walk_nodes(root, [&res](BlockNode *node) {
+    for (auto &b : node->chunk.blocks) {
+      if (b) {
+        res++;
+      }
+    }
+  });
+  return res;
+}
+
+void BlockList::clear() {
+  delete_nodes(root);
+  root = nullptr;
+}
+
+BlockNode *BlockList::create_node(int count, unsigned priority) {
+  if (priority == 0) {
+    // xorshift
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    priority = seed;
+  }
+  BlockNode *node = new BlockNode{BlockChunk{count}, count, priority, nullptr,
+                                  nullptr};
+  return node;
+}
+
+// returns the node holding line, and the line's index within its chunk
+BlockNode *BlockList::locate(int line, int *offset) {
+  BlockNode *node = root;
+  while (node) {
+    int left = node_size(node->left);
+    if (line < left) {
+      node = node->left;
+    } else if (line < left + node->chunk.count) {
+      *offset = line - left;
+      return node;
+    } else {
+      line -= left + node->chunk.count;
+      node = node->right;
+    }
+  }
+  return nullptr;
+}
+
+// split into the first `line` lines and the rest, cutting a chunk if needed
+void BlockList::split(BlockNode *node, int line, BlockNode *&left,
+                      BlockNode *&right) {
+  if (!node) {
+    left = right = nullptr;
+    return;
+  }
+
+  int l = node_size(node->left);
+  if (line <= l) {
+    split(node->left, line, left, node->left);
+    right = node;
+    update_node(right);
+  } else if (line >= l + node->chunk.count) {
+    split(node->right, line - l - node->chunk.count, node->right, right);
+    left = node;
+    update_node(left);
+  } else {
+    // the tail takes over the right subtree, so it keeps the same priority
+    int offset = line - l;
+    BlockChunk &head = node->chunk;
+    BlockNode *tail = create_node(head.count - offset, node->priority);
+    if (head.is_materialized()) {
+      tail->chunk.blocks.assign(head.blocks.begin() + offset,
+                                head.blocks.end());
+      head.blocks.resize(offset);
+    }
+    head.count = offset;
+    tail->right = node->right;
+    node->right = nullptr;
+    update_node(tail);
+    update_node(node);
+    left = node;
+    right = tail;
+  }
+}
+
+BlockNode *BlockList::merge(BlockNode *left, BlockNode *right) {
+  if (!left || !right) {
+    return left ? left : right;
+  }
+  if (left->priority > right->priority) {
+    left->right = merge(left->right, right);
+    update_node(left);
+    return left;
+  }
+  right->left = merge(left, right->left);
+  update_node(right);
+  return right;
+}
+
+// try to absorb a small insert into an existing chunk in place
+bool BlockList::grow(BlockNode *node, int line, int count) {
+  if (!node) {
+    return false;
+  }
+  int l = node_size(node->left);
+  bool res = false;
+  if (line < l) {
+    res = grow(node->left, line, count);
+  } else if (line <= l + node->chunk.count) {
+    BlockChunk &chunk = node->chunk;
+    if (!chunk.is_materialized()) {
+      chunk.count += count;
+      res = true;
+    } else if (chunk.count + count <= BLOCK_CHUNK_SIZE * 2) {
+      chunk.blocks.insert(chunk.blocks.begin() + (line - l), count, nullptr);
+      chunk.count += count;
+      res = true;
+    }
+  } else {
+    res = grow(node->right, line - l - node->chunk.count, count);
+  }
+  if (res) {
+    update_node(node);
+  }
+  return res;
+}
+
+BlockPtr BlockList::find(int line) {
+  if (line < 0 || line >= size()) {
+    return nullptr;
+  }
+  int offset;
+  BlockNode *node = locate(line, &offset);
+  if (!node->chunk.is_materialized()) {
+    return nullptr;
+  }
+  return node->chunk.blocks[offset];
+}
+
+BlockPtr BlockList::at(int line) {
+  if (line < 0 || line >= size()) {
+    return nullptr;
+  }
+
+  int offset;
+  BlockNode *node = locate(line, &offset);
+
+  // carve a chunk sized piece out of a large lazy run before allocating
+  if (!node->chunk.is_materialized() &&
+      node->chunk.count > BLOCK_CHUNK_SIZE) {
+    int start = line - (offset % BLOCK_CHUNK_SIZE);
+    int end = line - offset + node->chunk.count;
+    if (end > start + BLOCK_CHUNK_SIZE) {
+      end = start + BLOCK_CHUNK_SIZE;
+    }
+    BlockNode *a, *b, *c;
+    split(root, start, a, b);
+    split(b, end - start, b, c);
+    root = merge(merge(a, b), c);
+    node = b;
+    offset = line - start;
+  }
+
+  BlockChunk &chunk = node->chunk;
+  if (!chunk.is_materialized()) {
+    chunk.blocks.resize(chunk.count);
+  }
+
+  BlockPtr &block = chunk.blocks[offset];
+  if (!block) {
+    block = std::make_shared<Block>();
+    block->line = line;
+  }
+  return block;
+}
+
+void BlockList::insert(int line, int lines) {
+  if (lines <= 0) {
+    return;
+  }
+  if (line > size()) {
+    line = size();
+  }
+  if (grow(root, line, lines)) {
+    return;
+  }
+  BlockNode *left, *right;
+  split(root, line, left, right);
+  root = merge(merge(left, create_node(lines)), right);
+}
+
+void BlockList::erase(int line, int lines) {
+  int l = size();
+  if (line < 0 || line >= l || lines <= 0) {
+    return;
+  }
+  if (line + lines > l) {
+    lines = l - line;
+  }
+  BlockNode *left, *middle, *right;
+  split(root, line, left, middle);
+  split(middle, lines, middle, right);
+  delete_nodes(middle);
+  root = merge(left, right);
+}
+
+void BlockList::make_dirty(int line) {
+  int start = 0;
+  walk_nodes(root, [&start, line](BlockNode *node) {
+    BlockChunk &chunk = node->chunk;
+    for (int i = 0; i < chunk.blocks.size(); i++) {
+      if (start + i >= line && chunk.blocks[i]) {
+        chunk.blocks[i]->make_dirty();
+      }
+    }
+    start += chunk.count;
+  });
+}
@@ -0,0 +1,64 @@
+#ifndef TE_BLOCKS_H
+#define TE_BLOCKS_H
+
+#include <memory>
+#include <vector>
+
+class Block;
+typedef std::shared_ptr<Block> BlockPtr;
+
+// A run of lines. Per-line Blocks are only allocated once a line in the
+// chunk is asked for; until then the chunk is just a line count.
+class BlockChunk {
+public:
+  int count;
+  std::vector<BlockPtr> blocks;
+
+  bool is_materialized() { return blocks.size() > 0; }
+};
+
+// chunks are kept in a treap ordered by line, each node caching the number
+// of lines in its subtree, so finding a line and splicing a range of lines
+// are O(log n) regardless of how many lines are involved
+class BlockNode {
+public:
+  BlockChunk chunk;
+  int size;
+  unsigned priority;
+  BlockNode *left;
+  BlockNode *right;
+};
+
+class BlockList {
+public:
+  BlockList();
+  ~BlockList();
+
+  // the list owns its nodes; it is never copied or moved
+  BlockList(const BlockList &) = delete;
+  BlockList &operator=(const BlockList &) = delete;
+  BlockList(BlockList &&) = delete;
+  BlockList &operator=(BlockList &&) = delete;
+
+  int size();
+  int materialized();
+  void clear();
+
+  BlockPtr at(int line);
+  BlockPtr find(int line);
+  void insert(int line, int count);
+  void erase(int line, int count);
+  void make_dirty(int line);
+
+private:
+  BlockNode *root;
+  unsigned seed;
+
+  BlockNode *create_node(int count, unsigned priority = 0);
+  BlockNode *locate(int line, int *offset);
+  void split(BlockNode *node, int line, BlockNode *&left, BlockNode *&right);
+  BlockNode *merge(BlockNode *left, BlockNode *right);
+  bool grow(BlockNode *node, int line, int count);
+};
+
+#endif // TE_BLOCKS_H
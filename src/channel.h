@@ -0,0 +1,73 @@
+#ifndef TE_CHANNEL_H
+#define TE_CHANNEL_H
+
+#include <atomic>
+#include <stddef.h>
+
+#define CHANNEL_SEGMENT 64
+
+// Unbounded single-producer/single-consumer queue. Items live in fixed
+// segments; the producer links a fresh segment when the current one fills
+// up and never looks back, so the consumer frees a segment as soon as it has
+// drained it and moved on. Neither side ever blocks or takes a lock.
+template <typename T> class Channel {
+public:
+  class Segment {
+  public:
+    Segment() : written(0), next(0), read(0) {}
+
+    T items[CHANNEL_SEGMENT];
+    std::atomic<size_t> written; // published by the producer
+    std::atomic<Segment *> next;
+    size_t read; // consumer only
+  };
+
+  Channel() { head = tail = new Segment(); }
+
+  ~Channel() {
+    while (head) {
+      Segment *next = head->next;
+      delete head;
+      head = next;
+    }
+  }
+
+  Segment *head; // consumer
+  Segment *tail; // producer
+
+  // producer
+  void push(T item) {
+    size_t index = tail->written.load(std::memory_order_relaxed);
+    if (index < CHANNEL_SEGMENT) {
+      tail->items[index] = std::move(item);
+      tail->written.store(index + 1, std::memory_order_release);
+      return;
+    }
+    Segment *segment = new Segment();
+    segment->items[0] = std::move(item);
+    segment->written.store(1, std::memory_order_relaxed);
+    tail->next.store(segment, std::memory_order_release);
+    tail = segment;
+  }
+
+  // consumer
+  bool pop(T &item) {
+    while (true) {
+      if (head->read < head->written.load(std::memory_order_acquire)) {
+        item = std::move(head->items[head->read++]);
+        return true;
+      }
+      if (head->read < CHANNEL_SEGMENT) {
+        return false;
+      }
+      Segment *next = head->next.load(std::memory_order_acquire);
+      if (!next) {
+        return false;
+      }
+      delete head;
+      head = next;
+    }
+  }
+};
+
+#endif // TE_CHANNEL_H
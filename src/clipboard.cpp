@@ -0,0 +1,59 @@
+#include "clipboard.h"
+#include "document.h"
+
+Clipboard::Clipboard() : source(0), snapshot(0), length(0) {}
+
+Clipboard::~Clipboard() { clear(); }
+
+void Clipboard::clear() {
+  if (snapshot) {
+    delete snapshot;
+    snapshot = 0;
+  }
+  source = 0;
+  ranges.clear();
+  data.clear();
+  length = 0;
+}
+
+void Clipboard::set(Document *doc, std::vector<Range> selections) {
+  clear();
+  source = doc;
+  snapshot = doc->buffer.create_snapshot();
+  for (auto r : selections) {
+    if (r.start == r.end) {
+      continue;
+    }
+    for (auto slice : snapshot->chunks_in_range(r)) {
+      length += slice.size();
+    }
+    ranges.push_back(r);
+  }
+}
+
+// the source buffer is going away, its snapshot must not outlive it
+void Clipboard::release(Document *doc) {
+  if (source != doc || !snapshot) {
+    return;
+  }
+  std::u16string res = text();
+  clear();
+  data = res;
+  length = data.size();
+}
+
+bool Clipboard::is_empty() { return length == 0; }
+
+std::u16string Clipboard::text() {
+  if (!snapshot) {
+    return data;
+  }
+  std::u16string res;
+  res.reserve(length);
+  for (auto r : ranges) {
+    for (auto slice : snapshot->chunks_in_range(r)) {
+      res.append(slice.data(), slice.size());
+    }
+  }
+  return res;
+}
@@ -0,0 +1,30 @@
+#ifndef TE_CLIPBOARD_H
+#define TE_CLIPBOARD_H
+
+#include <core/text-buffer.h>
+#include <string>
+#include <vector>
+
+class Document;
+
+// Copied text kept as ranges of a snapshot of the source buffer. Nothing is
+// copied until the text is pasted or the source document goes away.
+class Clipboard {
+public:
+  Clipboard();
+  ~Clipboard();
+
+  Document *source;
+  TextBuffer::Snapshot *snapshot;
+  std::vector<Range> ranges;
+  std::u16string data; // materialized text once detached from the source
+  size_t length;
+
+  void set(Document *doc, std::vector<Range> selections);
+  void release(Document *doc);
+  void clear();
+  bool is_empty();
+  std::u16string text();
+};
+
+#endif // TE_CLIPBOARD_H
@@ -1,5 +1,6 @@
 #include "cursor.h"
 #include "document.h"
+#include "undo.h"
 
 bool compare_range(Range a, Range b) {
   size_t aline = a.start.row;
@@ -64,22 +65,7 @@ bool Cursor::move_up(bool anchor) {
     return false;
   }
   start.row--;
-
-  bool is_folded = false;
-  do {
-    is_folded = false;
-    for (auto f : document->folds) {
-      Cursor cur = f.copy();
-      cur.end.row++;
-      if (is_point_within_range({start.row, 0}, f)) {
-        if (start.row > 0) {
-          start.row--;
-        }
-        is_folded = true;
-        break;
-      }
-    }
-  } while (is_folded);
+  start.row = document->fold_index().visible_above(start.row);
 
   if (start.row < 0) {
     start.row = prev_row;
@@ -99,20 +85,7 @@ bool Cursor::move_up(bool anchor) {
 bool Cursor::move_down(bool anchor) {
   int prev_row = start.row;
   start.row++;
-
-  bool is_folded = false;
-  do {
-    is_folded = false;
-    for (auto f : document->folds) {
-      Cursor cur = f.copy();
-      cur.end.row++;
-      if (is_point_within_range({start.row, 0}, f)) {
-        start.row++;
-        is_folded = true;
-        break;
-      }
-    }
-  } while (is_folded);
+  start.row = document->fold_index().visible_below(start.row);
 
   int size = document->size();
   if (start.row + 1 > size) {
@@ -344,59 +317,59 @@ void Cursor::insert_text(std::u16string text) {
     move_right(true);
   }
   Range range = normalized();
-  int r = 0;
-  int start_size = document->size();
-  buffer->set_text_in_range(range, text.data());
-  int size_diff = document->size() - start_size;
-  if (size_diff > 0) {
-    r = size_diff;
-  }
-
-  // document->cursor_markers.splice(range.start, {0, 0}, {r, text.size()});
-  document->update_markers(range.start,
-                           {0, range.end.column - range.start.column},
-                           {r, text.size()});
-  document->update_blocks(range.start.row, size_diff);
+  Point removed = range.end.traversal(range.start);
+  Point inserted = text_extent(text.data(), text.size());
+  bool is_newline = text.size() > 0 && text[0] == '\n';
+  document->record_change(range, text);
+  buffer->set_text_in_range(range, std::move(text));
+
+  document->update_markers(range.start, removed, inserted);
+  document->splice_blocks(range.start.row, removed.row, inserted.row);
   clear_selection();
 
-  if (document->cursors.size() > 1 && text[0] == '\n')
+  if (document->cursors.size() > 1 && is_newline)
     return;
 
-  for (int i = 0; i < text.size(); i++) {
-    move_right();
-  }
-  if (start.row != range.start.row && size_diff == 0) {
-    move_left();
+  start = range.start.traverse(inserted);
+  end = start;
+}
+
+// end of the span covering number_of_characters from point, counting a line
+// break as one character
+static Point advance_characters(TextBuffer *buffer, Point point,
+                                int number_of_characters) {
+  Point extent = buffer->extent();
+  while (number_of_characters > 0 && point < extent) {
+    int l = *buffer->line_length_for_row(point.row);
+    int available = l - point.column;
+    if (available <= 0) {
+      point.row++;
+      point.column = 0;
+      number_of_characters--;
+      continue;
+    }
+    int step = number_of_characters < available ? number_of_characters
+                                                 : available;
+    point.column += step;
+    number_of_characters -= step;
   }
+  return point;
 }
 
 void Cursor::delete_text(int number_of_characters) {
-  if (has_selection()) {
-    number_of_characters = 1;
+  if (!has_selection()) {
+    end = advance_characters(buffer, start, number_of_characters);
   }
-  for (int i = 0; i < number_of_characters; i++) {
-    if (!has_selection()) {
-      move_right(true);
-    }
-    Range range = normalized();
-    int c = 1;
-    int r = 0;
-    if (has_selection()) {
-      c = range.end.column - range.start.column;
-    }
-    int start_size = document->size();
-    buffer->set_text_in_range(range, u"");
-    int size_diff = document->size() - start_size;
-    if (size_diff < 0) {
-      r = -size_diff;
-      c = 0;
-    }
-    document->cursor_markers.splice(range.start, {r, c}, {0, 0});
-    // document->update_markers(range.start, {r, c}, {0,
-    // -range.end.column-range.start.column});
-    document->update_blocks(range.start.row, size_diff);
-    clear_selection();
+  Range range = normalized();
+  if (range.start == range.end) {
+    return;
   }
+  Point removed = range.end.traversal(range.start);
+  document->record_change(range, u"");
+  buffer->set_text_in_range(range, u"");
+  document->update_markers(range.start, removed, {0, 0});
+  document->splice_blocks(range.start.row, removed.row, 0);
+  clear_selection();
 }
 
 void Cursor::delete_next_text(std::u16string text) {
@@ -1,41 +1,65 @@
 #include "document.h"
+#include "clipboard.h"
 #include "files.h"
+#include "loader.h"
+#include "saver.h"
 #include "utf8.h"
 #include "util.h"
+#include "words.h"
 
 #include <algorithm>
+#include <chrono>
 #include <core/encoding-conversion.h>
 #include <core/regex.h>
-#include <fstream>
+#include <functional>
 #include <iostream>
-#include <sstream>
 
 #define TS_DOC_SIZE_LIMIT 20000
-#define TS_WORD_INDICES_LINE_LIMIT 500
 #define TS_FIND_FROM_CURSOR_LIMIT 1000
+#define LOAD_CHUNK_SIZE (1024 * 1024)
+#define LOAD_FIRST_CHUNK_SIZE (64 * 1024)
 
-static std::u16string clipboard_data;
+static Clipboard clipboard;
 
-Block::Block()
-    : block_data_t(), line(0), line_height(1), line_length(0), dirty(true) {}
+Document::Document()
+    : snapshot(0), edit_depth(0), insert_mode(true), load_throughput(0) {}
 
-void Block::make_dirty() {
-  dirty = true;
-  words.clear();
-  brackets.clear();
-  line_height = 1;
-  line_length = 0;
+// drops retired requests once their jobs are done with them
+template <class T> static void prune_retired(std::vector<T> &retired) {
+  retired.erase(std::remove_if(retired.begin(), retired.end(),
+                               [](T &t) { return t->state != t->Loading; }),
+                retired.end());
 }
 
-Document::Document() : snapshot(0), undo_snapshot(0), insert_mode(true) {}
-
 Document::~Document() {
+  // jobs still queued or running read snapshots of the buffer
+  for (auto &it : searches) {
+    if (it.second) {
+      it.second->release();
+    }
+  }
+  for (auto &it : autocompletes) {
+    if (it.second) {
+      it.second->release();
+    }
+  }
+  for (auto t : treesitters) {
+    t->release();
+  }
+  for (auto s : retired_searches) {
+    s->release();
+  }
+  for (auto a : retired_autocompletes) {
+    a->release();
+  }
+  for (auto t : retired_treesitters) {
+    t->release();
+  }
+
+  clipboard.release(this);
   if (snapshot) {
     delete snapshot;
   }
-  if (undo_snapshot) {
-    delete undo_snapshot;
-  }
 }
 
 std::u16string _detect_tab_string(std::u16string text) {
@@ -56,21 +80,22 @@ std::u16string &Document::empty() {
 }
 
 void Document::initialize(std::u16string &str) {
-  buffer.set_text(str);
+  buffer.set_text(std::move(str));
 
   buffer.flush_changes();
   blocks.clear();
+  journal.clear();
+  word_index.clear();
 
+  // blocks are created lazily as lines get highlighted or rendered
   int l = size();
-  for (int i = 0; i < l; i++) {
-    add_block_at(i);
-
-    // detect tab size
-    if (tab_string.size() == 0) {
-      optional<std::u16string> row = buffer.line_for_row(i);
-      if (row) {
-        tab_string = _detect_tab_string((*row));
-      }
+  blocks.insert(0, l);
+
+  // detect tab size
+  for (int i = 0; i < l && tab_string.size() == 0; i++) {
+    optional<std::u16string> row = buffer.line_for_row(i);
+    if (row) {
+      tab_string = _detect_tab_string((*row));
     }
   }
 
@@ -111,27 +136,114 @@ void Document::set_language(language_info_ptr lang) {
   }
 }
 
-bool Document::load(std::string path) {
+bool Document::load(std::string path, bool async) {
   file_path = path;
   name = base_name(path);
 
-  std::ifstream t(path);
-  std::stringstream buffer;
-  buffer << t.rdbuf();
+  auto start = std::chrono::steady_clock::now();
+
+  LoaderPtr _loader = std::make_shared<Loader>(path);
 
   std::u16string str;
+  if (_loader->open()) {
+    // decode everything, or just enough to fill the first screen
+    size_t limit = _loader->file.size;
+    if (async && limit > LOAD_FIRST_CHUNK_SIZE) {
+      limit = LOAD_FIRST_CHUNK_SIZE;
+    }
 
-  optional<EncodingConversion> enc = transcoding_from("UTF-8");
-  (*enc).decode(str, buffer.str().c_str(), buffer.str().size());
+    // utf-8 never decodes to more utf-16 code units than it has bytes
+    str.reserve(limit);
+    while (_loader->offset < limit) {
+      size_t length = limit - _loader->offset;
+      if (length > LOAD_CHUNK_SIZE) {
+        length = LOAD_CHUNK_SIZE;
+      }
+      // a chunk may end mid-sequence; the remainder is carried to the next
+      if (_loader->decode(str, length) == 0) {
+        break;
+      }
+    }
+  }
 
   initialize(str);
+  history.open(path);
+
+  if (_loader->offset < _loader->file.size) {
+    // stream the rest from a worker, see update_loader
+    loader = _loader;
+    Loader::run(loader.get());
+    return true;
+  }
+
+  history.set_base_hash(_loader->hash.value());
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  double mb = (double)_loader->file.size / (1024 * 1024);
+  load_throughput = elapsed.count() > 0 ? mb / elapsed.count() : 0;
+  log("load %s %.2fMB %.3fs %.2fMB/s", name.c_str(), mb, elapsed.count(),
+      load_throughput);
   return true;
 }
 
+bool Document::is_loading() { return loader != nullptr; }
+
+bool Document::update_loader() {
+  if (!loader) {
+    return false;
+  }
+
+  // check before taking so that the last chunk is never missed
+  bool done = loader->is_ready();
+
+  std::u16string str;
+  bool appended = loader->take(str);
+  if (appended) {
+    int line = size() - 1;
+    int start_size = size();
+    Point end = buffer.extent();
+    buffer.set_text_in_range(Range{end, end}, std::move(str));
+    splice_blocks(line, 0, size() - start_size);
+  }
+
+  if (done) {
+    load_throughput = loader->throughput;
+    history.set_base_hash(loader->hash.value());
+    loader->set_consumed();
+    loader = nullptr;
+    buffer.flush_changes();
+    snap();
+  }
+
+  return appended || done;
+}
+
 bool Document::save(std::string path) {
-  std::string _sstring = u16string_to_string(buffer.text());
-  std::ofstream t(path);
-  t << _sstring;
+  if (is_loading()) {
+    return false;
+  }
+  if (saver && saver->is_saving()) {
+    return false;
+  }
+
+  // a finished save not picked up by the ui yet
+  if (saver && saver->history) {
+    history.apply(*saver->history);
+    saver->history = nullptr;
+  }
+
+  // the worker encodes from a snapshot, the buffer stays editable
+  buffer.flush_changes();
+  saver = std::make_shared<Saver>(path);
+  saver->snapshot = buffer.create_snapshot();
+  if (path == file_path) {
+    saver->history = std::make_unique<HistoryWrite>();
+    if (!history.prepare(journal, *saver->history)) {
+      saver->history = nullptr;
+    }
+  }
+  Saver::run(saver.get());
   return true;
 }
 
@@ -191,32 +303,33 @@ void Document::go_to_line(int line) {
 }
 
 void Document::insert_text(std::u16string text) {
-  prepare_undo();
-
   std::sort(cursors.begin(), cursors.end(), compare_range_reverse);
+  begin_edit();
   for (auto &c : cursors) {
-    begin_cursor_markers(c);
     c.insert_text(text);
-    end_cursor_markers(c);
+    track_cursor(c);
   }
+  end_edit();
 }
 
 void Document::delete_text(int number_of_characters) {
-  prepare_undo();
+  std::sort(cursors.begin(), cursors.end(), compare_range_reverse);
+  begin_edit();
   for (auto &c : cursors) {
-    begin_cursor_markers(c);
     c.delete_text(number_of_characters);
-    end_cursor_markers(c);
+    track_cursor(c);
   }
+  end_edit();
 }
 
 void Document::delete_next_text(std::u16string text) {
-  prepare_undo();
+  std::sort(cursors.begin(), cursors.end(), compare_range_reverse);
+  begin_edit();
   for (auto &c : cursors) {
-    begin_cursor_markers(c);
     c.delete_next_text(text);
-    end_cursor_markers(c);
+    track_cursor(c);
   }
+  end_edit();
 }
 
 void Document::move_to_start_of_document(bool anchor) {
@@ -277,9 +390,9 @@ void Document::duplicate_selection() {
 }
 
 void Document::duplicate_line() {
-  prepare_undo();
+  std::sort(cursors.begin(), cursors.end(), compare_range_reverse);
+  begin_edit();
   for (auto &c : cursors) {
-    begin_cursor_markers(c);
     std::u16string r = u"\n";
     optional<std::u16string> row = buffer.line_for_row(c.start.row);
     if (row) {
@@ -287,8 +400,9 @@ void Document::duplicate_line() {
     }
     c.move_to_end_of_line();
     c.insert_text(r);
-    end_cursor_markers(c);
+    track_cursor(c);
   }
+  end_edit();
   commit_undo();
 }
 
@@ -369,26 +483,26 @@ std::vector<int> Document::selected_lines() {
 
 void Document::make_dirty(int line) {
   // dirty all
-  while (blocks.size() < size()) {
-    add_block_at(0);
+  int l = size();
+  if (blocks.size() < l) {
+    blocks.insert(blocks.size(), l - blocks.size());
   }
-
-  while (blocks.size() > size()) {
-    blocks.pop_back();
+  if (blocks.size() > l) {
+    blocks.erase(l, blocks.size() - l);
   }
 
-  auto it = blocks.begin();
-  if (line >= size())
-    return;
-  it += line;
-  while (it != blocks.end()) {
-    BlockPtr b = *it++;
-    b->make_dirty();
-  }
+  blocks.make_dirty(line);
 }
 
-void Document::begin_cursor_markers(Cursor &cur) {
-  redo_patches.clear();
+// An edit transaction: every cursor and fold goes into the marker indexes
+// once, edits made in between keep them in place, and end_edit reads them
+// all back. Edits must be made back to front, so that each one happens at
+// coordinates the edits before it left untouched.
+void Document::begin_edit() {
+  if (edit_depth++ > 0) {
+    return;
+  }
+  journal.clear_redo();
   int idx = 0;
   for (auto &c : cursors) {
     c.id = idx++;
@@ -397,15 +511,75 @@ void Document::begin_cursor_markers(Cursor &cur) {
   begin_fold_markers();
 }
 
-void Document::end_cursor_markers(Cursor &cur) {
+// re-anchors a cursor after its own edit moved it
+void Document::track_cursor(Cursor &cur) {
+  if (cur.id < 0) {
+    return;
+  }
+  cursor_markers.remove(cur.id);
+  cursor_markers.insert(cur.id, cur.start, cur.end);
+}
+
+void Document::end_edit() {
+  if (--edit_depth > 0) {
+    return;
+  }
   for (auto &c : cursors) {
-    if (c.id != cur.id) {
-      c.start = cursor_markers.get_start(c.id);
-      c.end = cursor_markers.get_end(c.id);
-    }
+    c.start = cursor_markers.get_start(c.id);
+    c.end = cursor_markers.get_end(c.id);
     cursor_markers.remove(c.id);
   }
   end_fold_markers();
+  invalidate_edited_blocks();
+}
+
+// Dirties the lines touched by the transaction's splices, mapped to where
+// they ended up. A splice is shifted by the row changes of the splices
+// made after it on earlier lines; one on its own line can only push its
+// end further down.
+void Document::invalidate_edited_blocks() {
+  std::vector<BlockSplice> splices;
+  splices.swap(edit_splices);
+  if (splices.size() == 0) {
+    return;
+  }
+
+  std::vector<std::pair<int, int>> dirty;
+  int shift = 0;      // row changes of later splices on earlier lines
+  int same_shift = 0; // row changes of later splices on the same line
+  int same_grow = 0;  // rows those added
+  int same_line = -1;
+  for (int i = splices.size() - 1; i >= 0; i--) {
+    BlockSplice &sp = splices[i];
+    if (sp.line != same_line) {
+      if (same_line != -1 && sp.line < same_line) {
+        // not back to front, fall back to everything below
+        make_dirty(sp.line);
+        return;
+      }
+      shift += same_shift;
+      same_shift = 0;
+      same_grow = 0;
+      same_line = sp.line;
+    }
+    int start = sp.line + shift;
+    dirty.push_back({start, start + sp.inserted + same_grow + 1});
+    int diff = sp.inserted - sp.removed;
+    same_shift += diff;
+    same_grow += diff > 0 ? diff : 0;
+  }
+
+  std::sort(dirty.begin(), dirty.end());
+  int next = 0;
+  for (auto &r : dirty) {
+    int row = r.first > next ? r.first : next;
+    for (; row <= r.second; row++) {
+      BlockPtr block = blocks.find(row);
+      if (block)
+        block->make_dirty();
+    }
+    next = row;
+  }
 }
 
 void Document::begin_fold_markers() {
@@ -434,36 +608,18 @@ void Document::end_fold_markers() {
       folds.erase(it);
     }
   }
+  fold_spans.make_dirty();
 }
 
-void Document::begin_undo_markers() {
-  int idx = 0;
-  for (auto &c : entries) {
-    c->id = idx++;
-    // undo_markers.insert(c.id, c.start, c.end);
-  }
-}
-
-void Document::end_undo_markers() {
-  std::vector<Cursor> disposables;
-
-  for (auto &c : entries) {
-    // c.start = undo_markers.get_start(c.id);
-    // c.end = undo_markers.get_end(c.id);
-    // fold_markers.remove(c.id);
-    // if (c.end.row - c.start.row <= 0) {
-    //   disposables.push_back(c);
-    // }
-  }
+bool Document::is_within_fold(int row, int column) {
+  return fold_index().contains({row, column});
 }
 
-bool Document::is_within_fold(int row, int column) {
-  for (auto f : folds) {
-    if (is_point_within_range({row, column}, {f.start, f.end})) {
-      return true;
-    }
+FoldIndex &Document::fold_index() {
+  if (fold_spans.is_dirty()) {
+    fold_spans.build(folds);
   }
-  return false;
+  return fold_spans;
 }
 
 void Document::update_markers(Point a, Point b, Point c) {
@@ -471,69 +627,122 @@ void Document::update_markers(Point a, Point b, Point c) {
   fold_markers.splice(a, b, c);
 }
 
+optional<Cursor> Document::fold_cursor(Cursor curs) {
+  optional<Cursor> res;
+  Cursor cur = curs.normalized();
+  cur.move_to_end_of_line();
+  optional<Cursor> block = block_cursor(cur);
+  if (!block || (*block).start == Point{0, 0}) {
+    return res;
+  }
+  cur.copy_from(*block);
+  cur = cur.normalized();
+  if (cur.start.column == 0) {
+    cur.start.column = 1;
+  }
+  if (cur.start.row == cur.end.row) {
+    return res;
+  }
+  res = cur.copy();
+  return res;
+}
+
 void Document::toggle_fold(Cursor curs) {
   // requires an updated treesitter
   if (!treesitter())
     return;
 
-  // move to doc
+  optional<Cursor> fold = fold_cursor(curs);
+  if (!fold) {
+    return;
+  }
+
+  auto it = std::find(folds.begin(), folds.end(), *fold);
+  if (it != folds.end()) {
+    folds.erase(it);
+    fold_spans.make_dirty();
+    return;
+  }
+
   Cursor cur = curs.normalized();
   cur.move_to_end_of_line();
-  optional<Cursor> block = block_cursor(cur);
-  if (block) {
-    if ((*block).start == Point{0, 0}) {
-      return;
-    }
-    Cursor b = (*block).copy();
-    if (b.start.column == 0) {
-      b.start.column = 1;
-    }
-    auto it = std::find(folds.begin(), folds.end(), b);
-    if (it != folds.end()) {
-      folds.erase(it);
-      return;
-    }
-    if (is_within_fold(cur.start.row, cur.start.column)) {
-      return;
+  if (is_within_fold(cur.start.row, cur.start.column)) {
+    return;
+  }
+
+  folds.push_back(*fold);
+  clear_cursors();
+  cursor().copy_from(*fold);
+  clear_selection();
+
+  std::sort(folds.begin(), folds.end(), compare_range);
+  fold_spans.make_dirty();
+}
+
+static void collect_fold_rows(TSNode node, std::vector<int> &rows) {
+  int count = ts_node_child_count(node);
+  for (int i = 0; i < count; i++) {
+    TSNode child = ts_node_child(node, i);
+    TSPoint start = ts_node_start_point(child);
+    TSPoint end = ts_node_end_point(child);
+    // single line nodes cannot contain a fold
+    if (start.row == end.row) {
+      continue;
     }
-    cur.copy_from(*block);
-    cur = cur.normalized();
-    if (cur.start.column == 0) {
-      cur.start.column = 1;
+    if (ts_node_child_count(child) > 0) {
+      rows.push_back(start.row);
     }
-    folds.push_back(cur.copy());
-    clear_cursors();
-    cursor().copy_from(cur);
-    clear_selection();
-
-    std::sort(folds.begin(), folds.end(), compare_range);
+    collect_fold_rows(child, rows);
   }
 }
 
-int Document::computed_line(int line) {
-  int prev_end = 0;
-  for (auto f : folds) {
-    if (f.start.row < prev_end)
+void Document::fold_all() {
+  TreeSitterPtr tree = treesitter();
+  if (!tree) {
+    return;
+  }
+
+  std::vector<int> rows;
+  collect_fold_rows(ts_tree_root_node(tree->tree), rows);
+  std::sort(rows.begin(), rows.end());
+  rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+
+  // fold what toggle_fold would fold at each of those lines, so that any
+  // of them can later be unfolded individually
+  Cursor cur = cursor().copy();
+  for (int row : rows) {
+    cur.start = {row, 0};
+    cur.end = cur.start;
+    optional<Cursor> fold = fold_cursor(cur);
+    if (!fold) {
       continue;
-    if (line > f.start.row) {
-      line += f.end.row - f.start.row;
     }
-    prev_end = f.end.row;
+    if (std::find(folds.begin(), folds.end(), *fold) == folds.end()) {
+      folds.push_back(*fold);
+    }
   }
-  return line;
+  std::sort(folds.begin(), folds.end(), compare_range);
+  fold_spans.make_dirty();
+
+  // keep the cursor on a visible line
+  clear_cursors();
+  Cursor &main = cursor();
+  main.start.row = fold_index().visible_above(main.start.row);
+  main.start.column = 0;
+  main.end = main.start;
+}
+
+void Document::unfold_all() {
+  folds.clear();
+  fold_spans.make_dirty();
+}
+
+int Document::computed_line(int line) {
+  return fold_index().visual_to_buffer(line);
 }
 
 int Document::computed_size() {
-  int l = size();
-  int sz = 0;
-  int prev_end = 0;
-  for (auto f : folds) {
-    if (f.start.row < prev_end)
-      continue;
-    sz += f.start.row - f.end.row;
-    prev_end = f.end.row;
-  }
-  l -= sz;
+  int l = size() - fold_index().hidden_rows();
   if (l < 1) {
     l = 1;
   }
@@ -543,34 +752,30 @@ int Document::computed_size() {
 int Document::size() { return buffer.extent().row + 1; }
 
 BlockPtr Document::block_at(int line) {
-
-  if (line >= blocks.size() || line < 0)
+  BlockPtr block = blocks.at(line);
+  if (!block)
     return NULL;
 
-  if (blocks[line]->line != line) {
-    blocks[line]->make_dirty();
-    blocks[line]->line = line;
+  // a block that moved with an edit above it keeps its highlighting, the
+  // rows the edit touched were dirtied by splice_blocks
+  if (block->line != line) {
+    for (auto &w : block->words) {
+      w.start.row = line;
+      w.end.row = line;
+    }
+    block->line = line;
   }
-  return blocks[line];
+  return block;
 }
 
 BlockPtr Document::add_block_at(int line) {
-  BlockPtr block = std::make_shared<Block>();
-  block->line = line;
-  if (line >= blocks.size()) {
-    blocks.push_back(block);
-  } else {
-    blocks.insert(blocks.begin() + line, block);
-  }
-  return block;
+  blocks.insert(line, 1);
+  return block_at(line);
 }
 
 BlockPtr Document::erase_block_at(int line) {
-  if (line >= blocks.size())
-    return NULL;
-  auto it = blocks.begin() + line;
-  BlockPtr block = *it;
-  blocks.erase(it);
+  BlockPtr block = blocks.find(line);
+  blocks.erase(line, 1);
   return block;
 }
 
@@ -583,26 +788,38 @@ BlockPtr Document::next_block(BlockPtr block) {
 }
 
 void Document::update_blocks(int line, int count) {
-  BlockPtr block = block_at(line);
-  if (!block) {
+  splice_blocks(line, count < 0 ? -count : 0, count > 0 ? count : 0);
+}
+
+// an edit starting at line replaced `removed` following lines with
+// `inserted` new ones; the edited line keeps its block
+void Document::splice_blocks(int line, int removed, int inserted) {
+  // the rows replaced were taken out of the index by record_change
+  index_rows(line, line + inserted, 1);
+
+  if (line < 0 || line >= blocks.size()) {
     return;
   }
 
-  block->make_dirty();
-  BlockPtr next = next_block(block);
-  if (next)
-    next->make_dirty();
-
-  if (count == 0)
+  if (edit_depth > 0) {
+    // dirtied once the transaction ends, see invalidate_edited_blocks
+    blocks.erase(line + 1, removed);
+    blocks.insert(line + 1, inserted);
+    edit_splices.push_back(BlockSplice{line, removed, inserted});
     return;
-  int r = count > 0 ? count : -count;
-  for (int i = 0; i < r; i++) {
-    if (count < 0) {
-      erase_block_at(line);
-    } else {
-      add_block_at(line);
-    }
   }
+
+  // lines without a block yet are implicitly dirty
+  BlockPtr block = blocks.find(line);
+  if (block)
+    block->make_dirty();
+
+  blocks.erase(line + 1, removed);
+  blocks.insert(line + 1, inserted);
+
+  BlockPtr next = blocks.find(line + inserted + 1);
+  if (next)
+    next->make_dirty();
 }
 
 // todo ... move to thread?
@@ -641,63 +858,54 @@ optional<Range> Document::find_from_cursor(std::u16string text, Cursor cursor) {
   // return buffer.find(regex, range);
 }
 
-void Document::copy() { clipboard_data = selected_text(); }
+void Document::copy() {
+  std::vector<Range> ranges;
+  for (auto c : cursors) {
+    ranges.push_back(c.normalized());
+  }
+  clipboard.set(this, ranges);
+}
 
 void Document::paste() {
-  if (clipboard_data.size() > 0) {
-    insert_text(clipboard_data);
+  if (!clipboard.is_empty()) {
+    insert_text(clipboard.text());
   }
 }
 
 std::vector<Range> Document::words_in_line(int line) {
-  std::vector<Range> words;
+  BlockPtr block = block_at(line);
+  if (block && block->has_words) {
+    return block->words;
+  }
 
+  std::vector<Range> words;
   optional<std::u16string> row = buffer.line_for_row(line);
-  if (!row) {
-    return words;
+  if (row) {
+    tokenize_words((*row).data(), (*row).size(), line, words);
   }
+  if (block) {
+    block->words = words;
+    block->has_words = true;
+  }
+  return words;
+}
 
-  std::u16string str = *row;
-
-  static std::u16string pattern = u"[a-zA-Z_0-9]+";
-  std::u16string error;
-  Regex regex(pattern.c_str(), &error, false, false);
-  Regex::MatchData data(regex);
-  Regex::MatchResult res = {Regex::MatchResult::None, 0, 0};
-
-  int idx = 0;
-  int offset = 0;
-  do {
-    offset += res.end_offset;
-    std::u16string sstr = str.substr(offset);
-    char16_t *_str = (char16_t *)sstr.c_str();
-    res = regex.match(_str, sstr.size() * 2, data);
-    if (res.type == Regex::MatchResult::Full) {
-      words.push_back(Range{Point{line, offset + res.start_offset},
-                            Point{line, offset + res.end_offset}});
-      // log("%d. %d %d %s", idx++, res.start_offset + offset, offset +
-      // res.end_offset,
-      //     u16string_to_string(str).substr(
-      //       res.start_offset + offset, res.end_offset - res.start_offset
-      //       ).c_str());
+void Document::index_rows(int first, int last, int delta) {
+  if (word_index.state == WordIndex::State::Empty) {
+    return;
+  }
+  for (int row = first; row <= last; row++) {
+    optional<std::u16string> line = buffer.line_for_row(row);
+    if (line) {
+      word_index.add_line(*line, delta);
     }
-  } while (res.type == Regex::MatchResult::Full);
-  return words;
+  }
 }
 
 std::vector<int> Document::word_indices_in_line(int line, bool start,
                                                 bool end) {
   std::vector<int> indices;
-  optional<unsigned int> length = buffer.line_length_for_row(line);
-  if (length && *length > TS_WORD_INDICES_LINE_LIMIT)
-    return indices;
-  BlockPtr block = block_at(line);
-  if (!block)
-    return indices;
-  if (block->words.size() == 0) {
-    block->words = words_in_line(line);
-  }
-  for (auto r : block->words) {
+  for (auto r : words_in_line(line)) {
     if (start) {
       indices.push_back(r.start.column);
     }
@@ -713,16 +921,17 @@ void Document::indent() {
   if (lines.size() < 0) {
     return;
   }
+  std::sort(lines.begin(), lines.end(), std::greater<int>());
+  begin_edit();
   for (auto m : lines) {
     Cursor c = cursor().copy();
     c.start.row = m;
     c.start.column = 0;
     c.end = c.start;
     c.id = -1;
-    begin_cursor_markers(c);
     c.insert_text(tab_string);
-    end_cursor_markers(c);
   }
+  end_edit();
 }
 
 void Document::unindent() {
@@ -730,6 +939,8 @@ void Document::unindent() {
   if (lines.size() < 0) {
     return;
   }
+  std::sort(lines.begin(), lines.end(), std::greater<int>());
+  begin_edit();
   for (auto m : lines) {
     optional<std::u16string> row = buffer.line_for_row(m);
     if (!row) {
@@ -743,14 +954,15 @@ void Document::unindent() {
     c.start.column = 0;
     c.end = c.start;
     c.id = -1;
-    begin_cursor_markers(c);
     c.delete_text(tab_string.length());
-    end_cursor_markers(c);
   }
+  end_edit();
 }
 
 void Document::auto_indent() {
   // determine indent
+  std::sort(cursors.begin(), cursors.end(), compare_range_reverse);
+  begin_edit();
   for (auto &c : cursors) {
     Cursor cur = c.copy();
     cur.move_up();
@@ -762,14 +974,14 @@ void Document::auto_indent() {
     if (block && (*block).start.row == cur.start.row) {
       sz += tab_string.size();
     }
-    begin_cursor_markers(c);
     c.move_to_start_of_line();
     for (int i = 0; i < sz; i++) {
       c.insert_text(u" ");
     }
     // c.insert_text(tab_string);
-    end_cursor_markers(c);
+    track_cursor(c);
   }
+  end_edit();
 }
 
 void Document::toggle_comment() {
@@ -801,13 +1013,14 @@ void Document::toggle_comment() {
     }
   }
 
+  std::sort(filtered_lines.begin(), filtered_lines.end(), std::greater<int>());
+  begin_edit();
   for (auto m : filtered_lines) {
     Cursor c = cursor().copy();
     c.start.row = m;
     c.start.column = count;
     c.end = c.start;
     c.id = -1;
-    begin_cursor_markers(c);
     if (has_uncommented) {
       c.insert_text(comment_string);
     } else {
@@ -815,8 +1028,8 @@ void Document::toggle_comment() {
       c.end = c.start;
       c.delete_text(comment_string.length());
     }
-    end_cursor_markers(c);
   }
+  end_edit();
 }
 
 optional<Range> Document::subsequence_range() {
@@ -849,18 +1062,70 @@ void Document::run_autocomplete() {
       return;
     if (autocomplete_substring != sub) {
       autocomplete_substring = sub;
+
+      if (!is_loading() && word_index.state == WordIndex::State::Empty) {
+        word_index.build(buffer);
+      }
+      bool indexed = word_index.update();
+      CompletionIndex *completions = CompletionIndex::instance();
+
       if (autocompletes.find(sub) != autocompletes.end()) {
-        if (autocompletes[sub] != nullptr) {
-          autocompletes[sub]->state = AutoComplete::State::Ready;
+        AutoCompletePtr cached = autocompletes[sub];
+        bool fresh = false;
+        if (cached && cached->indexed) {
+          fresh = cached->generation == completions->generation &&
+                  !cached->cancelled;
+        } else if (cached) {
+          fresh = !indexed && !cached->cancelled;
+        }
+        if (fresh) {
+          // one still running is picked up once published
+          if (cached->state != AutoComplete::State::Loading) {
+            cached->state = AutoComplete::State::Ready;
+          }
           return;
         }
       }
 
+      // only the newest prefix is wanted
+      for (auto &it : autocompletes) {
+        if (it.second && it.second->state == AutoComplete::State::Loading) {
+          it.second->cancel();
+        }
+      }
+
+      prune_retired(retired_autocompletes);
+      AutoCompletePtr replaced = autocompletes[sub];
+      if (replaced && replaced->state == AutoComplete::State::Loading) {
+        retired_autocompletes.push_back(replaced);
+      }
+
       AutoCompletePtr autocomplete = std::make_shared<AutoComplete>(sub);
       autocomplete->document = this;
-      autocomplete->snapshot = buffer.create_snapshot();
       autocompletes[sub] = autocomplete;
-      AutoComplete::run(autocomplete.get());
+
+      if (indexed) {
+        // narrow down the longest cached prefix; words that came or went
+        // since it was answered are caught up from the index's log
+        unsigned generation = completions->generation;
+        AutoCompletePtr ancestor = nullptr;
+        for (size_t n = sub.size() - 1; n >= 3 && !ancestor; n--) {
+          auto it = autocompletes.find(sub.substr(0, n));
+          if (it != autocompletes.end() && it->second &&
+              it->second->indexed && !it->second->cancelled &&
+              it->second->state != AutoComplete::State::Loading) {
+            ancestor = it->second;
+          }
+        }
+        autocomplete->indexed = true;
+        autocomplete->generation = generation;
+        AutoComplete::run_indexed(autocomplete, ancestor);
+        return;
+      }
+
+      // scan the text until the index is built
+      autocomplete->snapshot = buffer.create_snapshot();
+      AutoComplete::run(autocomplete);
     }
   }
 }
@@ -914,18 +1179,31 @@ void Document::run_search(std::u16string key, Point first_index) {
   if (search_key != key) {
     search_key = key;
     if (searches.find(key) != searches.end()) {
-      if (searches[key] != nullptr) {
+      if (searches[key] != nullptr && !searches[key]->cancelled) {
         searches[key]->state = Search::State::Ready;
         return;
       }
     }
 
+    // only the newest key is wanted
+    for (auto &it : searches) {
+      if (it.second && it.second->state == Search::State::Loading) {
+        it.second->cancel();
+      }
+    }
+
+    prune_retired(retired_searches);
+    SearchPtr replaced = searches[key];
+    if (replaced && replaced->state == Search::State::Loading) {
+      retired_searches.push_back(replaced);
+    }
+
     SearchPtr search = std::make_shared<Search>(key, first_index);
     search->document = this;
     buffer.flush_changes();
     search->snapshot = buffer.create_snapshot();
     searches[key] = search;
-    Search::run(search.get());
+    Search::run(search);
   }
 }
 
@@ -960,15 +1238,6 @@ void Document::clear_search(bool force) {
   }
 }
 
-bool Document::has_pending_treesitters() {
-  for (auto t : treesitters) {
-    if (t->state < TreeSitter::Ready) {
-      return true;
-    }
-  }
-  return false;
-}
-
 void Document::run_treesitter() {
   if (!language)
     return;
@@ -981,26 +1250,49 @@ void Document::run_treesitter() {
 
   TreeSitterPtr treesitter = std::make_shared<TreeSitter>();
   treesitter->document = this;
+  treesitter->lang_id = language->id;
 
   buffer.flush_changes();
   treesitter->snapshot = buffer.create_snapshot();
   treesitter->snapshot->flush_preceding_changes();
 
+  // older revisions still parsing are superseded by this one; their jobs
+  // hold on to them until the parse has stopped
+  for (auto t : treesitters) {
+    if (t->state == TreeSitter::State::Loading && !t->cancelled) {
+      t->cancel();
+      log("treesitter: cancelled a parse superseded by a newer revision");
+    }
+  }
+  prune_retired(retired_treesitters);
+  for (auto t : treesitters) {
+    if (t->cancelled) {
+      retired_treesitters.push_back(t);
+    }
+  }
+  treesitters.erase(std::remove_if(treesitters.begin(), treesitters.end(),
+                                   [](TreeSitterPtr t) {
+                                     return t->cancelled != 0;
+                                   }),
+                    treesitters.end());
+
+  // diff against the newest finished revision
   if (treesitters.size() > 0) {
     treesitter->reference = treesitters.back();
-    if (treesitter->reference->state < TreeSitter::Ready) {
+    if (treesitter->reference->state < TreeSitter::Ready ||
+        !treesitter->reference->snapshot) {
       treesitter->reference = nullptr;
     } else {
       treesitter->reference->reference = nullptr;
       treesitter->patch =
           buffer.get_inverted_changes(treesitter->reference->snapshot);
-      while (treesitters.size() > 2) {
-        treesitters.erase(treesitters.begin());
-      }
     }
   }
+  while (treesitters.size() > 2) {
+    treesitters.erase(treesitters.begin());
+  }
   treesitters.push_back(treesitter);
-  TreeSitter::run(treesitter.get());
+  TreeSitter::run(treesitter);
 }
 
 TreeSitterPtr Document::treesitter() {
@@ -1172,95 +1464,81 @@ void Document::auto_close(int idx) {
   cursors = curs_backup;
 }
 
-void Document::prepare_undo() {
-  if (!undo_snapshot) {
-    buffer.flush_changes();
-    undo_snapshot = buffer.create_snapshot();
-  }
+// journals the text about to be replaced, before the buffer changes
+void Document::record_change(Range range, const std::u16string &text) {
+  journal.record(range, buffer.text_in_range(range), text);
+  index_rows(range.start.row, range.end.row, -1);
 }
 
 void Document::commit_undo() {
-  if (undo_snapshot) {
-
-    auto patch = buffer.get_inverted_changes(undo_snapshot);
-
-    HistoryEntryPtr entry;
-    bool has_changes = false;
-    for (auto c : patch.get_changes()) {
-      has_changes = true;
-      if (!entry) {
-        entry = std::make_shared<HistoryEntry>();
-        entries.push_back(entry);
-      }
-      entry->patches.push_back(TextPatch{
-          c.old_text->content.data(),
-          c.new_text->content.data(),
-          Range{c.old_start, c.old_end},
-          Range{c.new_start, c.new_end},
-      });
-    }
-
-    if (has_changes) {
-      delete undo_snapshot;
-      undo_snapshot = nullptr;
-    }
-  }
+  journal.commit();
+  history.sync(journal);
 }
 
 void Document::undo() {
   if (folds.size() > 0) {
-    folds.clear();
+    unfold_all();
     return;
   }
 
-  if (entries.size() == 0)
-    return;
+  commit_undo();
 
-  HistoryEntryPtr last = entries.back();
-  entries.pop_back();
+  // past the journal, older entries come from the history file
+  std::vector<UndoChange> changes;
+  if (journal.pop(changes)) {
+    history.sync(journal);
+  } else if (!history.pop(changes)) {
+    return;
+  }
 
+  std::vector<UndoChange> undone;
   Cursor cur = cursor();
 
-  auto it = last->patches.rbegin();
-  while (it != last->patches.rend()) {
-    auto c = *it++;
-    buffer.set_text_in_range(c.range, c.new_text.data());
+  for (auto &c : changes) {
+    std::u16string text = buffer.text_in_range(c.range);
+    index_rows(c.range.start.row, c.range.end.row, -1);
+    Point end =
+        c.range.start.traverse(text_extent(c.old_text.data(), c.old_text.size()));
+    buffer.set_text_in_range(c.range, std::move(c.old_text));
+    undone.push_back(UndoChange{Range{c.range.start, end}, std::move(text)});
+    splice_blocks(c.range.start.row, c.range.end.row - c.range.start.row,
+                  end.row - c.range.start.row);
     cur.start = c.range.start;
     cur.end = cur.start;
-    cursors.clear();
-    cursors.insert(cursors.begin(), cur.copy());
-    redo_patches.push_back(c);
   }
 
-  make_dirty();
+  cursors.clear();
+  cursors.insert(cursors.begin(), cur.copy());
+  journal.push_redo(undone);
+  history.sync(journal);
 }
 
 void Document::redo() {
   if (folds.size() > 0) {
-    folds.clear();
+    unfold_all();
     return;
   }
 
-  if (redo_patches.size() == 0)
+  // oldest edit first
+  std::vector<UndoChange> changes;
+  if (!journal.pop_redo(changes))
     return;
 
-  prepare_undo();
-
   Cursor cur = cursor();
-  cursors.clear();
 
-  for (auto c : redo_patches) {
-    std::string s = u16string_to_string(c.old_text.data());
-    buffer.set_text_in_range(c.range, c.old_text.data());
-    if (cursors.size() == 0) {
-      cur.start = c.new_range.start;
-      cur.end = cur.start;
-      cursors.insert(cursors.begin(), cur.copy());
-    }
+  for (auto &c : changes) {
+    Point end =
+        c.range.start.traverse(text_extent(c.old_text.data(), c.old_text.size()));
+    record_change(c.range, c.old_text);
+    buffer.set_text_in_range(c.range, std::move(c.old_text));
+    splice_blocks(c.range.start.row, c.range.end.row - c.range.start.row,
+                  end.row - c.range.start.row);
+    cur.start = end;
+    cur.end = cur.start;
   }
 
-  redo_patches.clear();
+  cursors.clear();
+  cursors.insert(cursors.begin(), cur.copy());
 
   commit_undo();
-  make_dirty();
 }
@@ -8,12 +8,19 @@
 #include <vector>
 
 #include "autocomplete.h"
+#include "blocks.h"
 #include "highlight.h"
+#include "history.h"
 #include "cursor.h"
+#include "folds.h"
+#include "loader.h"
+#include "saver.h"
 #include "parse.h"
 #include "search.h"
 #include "textmate.h"
 #include "treesitter.h"
+#include "undo.h"
+#include "wordindex.h"
 
 class Bracket {
 public:
@@ -21,23 +28,14 @@ public:
   int flags;
 };
 
-class TextPatch {
+// a block splice made inside an edit transaction, see Document::end_edit
+class BlockSplice {
 public:
-  std::u16string old_text;
-  std::u16string new_text;
-  Range range;
-  Range new_range;
-};
-
-class HistoryEntry {
-public:
-  int id;
-  std::vector<Cursor> cursors;
-  std::vector<TextPatch> patches;
+  int line;
+  int removed;
+  int inserted;
 };
 
-typedef std::shared_ptr<HistoryEntry> HistoryEntryPtr;
-
 // textmate::block_data_t { ---
 // parse::stack_ptr parser_state;
 // bool comment_block;
@@ -59,13 +57,12 @@ public:
   std::vector<span_info_t> span_infos;
 
   std::vector<Range> words;
+  bool has_words;
   std::vector<Bracket> brackets;
 
   void make_dirty();
 };
 
-typedef std::shared_ptr<Block> BlockPtr;
-
 class Document {
 public:
   Document();
@@ -75,46 +72,55 @@ public:
   std::string file_path;
 
   TextBuffer buffer;
-  TextBuffer::Snapshot *undo_snapshot;
   TextBuffer::Snapshot *snapshot;
-  std::vector<BlockPtr> blocks;
+  BlockList blocks;
 
   std::vector<Cursor> cursors;
   MarkerIndex cursor_markers;
+  int edit_depth;
+  std::vector<BlockSplice> edit_splices;
   std::vector<Cursor> folds;
+  FoldIndex fold_spans;
   MarkerIndex fold_markers;
-  MarkerIndex undo_markers;
 
   // background services
+  LoaderPtr loader;
+  SaverPtr saver;
   std::u16string autocomplete_substring;
   std::map<std::u16string, AutoCompletePtr> autocompletes;
+  WordIndex word_index;
   std::u16string search_key;
   std::map<std::u16string, SearchPtr> searches;
   std::vector<TreeSitterPtr> treesitters;
-  bool has_pending_treesitters();
+  // superseded requests whose jobs are still running
+  std::vector<SearchPtr> retired_searches;
+  std::vector<AutoCompletePtr> retired_autocompletes;
+  std::vector<TreeSitterPtr> retired_treesitters;
 
   // history
-  std::vector<HistoryEntryPtr> entries;
-
-  std::vector<TextPatch> redo_patches;
+  UndoJournal journal;
+  History history;
 
   language_info_ptr language;
   std::u16string comment_string;
   std::u16string tab_string;
   std::vector<std::string> autoclose_pairs;
   bool insert_mode;
+  double load_throughput; // MB/s of the last load
 
   static std::u16string &empty();
 
   void initialize(std::u16string &str);
-  bool load(std::string path);
+  bool load(std::string path, bool async = false);
+  bool is_loading();
+  bool update_loader();
   bool save(std::string path);
 
   void set_language(language_info_ptr lang);
 
   Cursor &cursor();
 
-  void prepare_undo();
+  void record_change(Range range, const std::u16string &text);
   void commit_undo();
 
   void move_up(bool anchor = false);
@@ -149,16 +155,20 @@ public:
   void clear_selection();
   void clear_cursors();
   void add_cursor(Cursor cursor);
-  void begin_cursor_markers(Cursor &cursor);
-  void end_cursor_markers(Cursor &cursor);
+  void begin_edit();
+  void end_edit();
+  void track_cursor(Cursor &cursor);
+  void invalidate_edited_blocks();
   void begin_fold_markers();
   void end_fold_markers();
-  void begin_undo_markers();
-  void end_undo_markers();
   void update_markers(Point a, Point b, Point c);
 
   void toggle_fold(Cursor cursor);
+  void fold_all();
+  void unfold_all();
+  optional<Cursor> fold_cursor(Cursor cursor);
   bool is_within_fold(int row, int column);
+  FoldIndex &fold_index();
 
   std::u16string subsequence_text();
   optional<Range> subsequence_range();
@@ -180,6 +190,7 @@ public:
   BlockPtr previous_block(BlockPtr block);
   BlockPtr next_block(BlockPtr block);
   void update_blocks(int line, int count);
+  void splice_blocks(int line, int removed, int inserted);
   void make_dirty(int line = 0);
 
   void indent();
@@ -189,6 +200,7 @@ public:
   std::vector<Range> words_in_line(int line);
   std::vector<int> word_indices_in_line(int line, bool start = true,
                                         bool end = true);
+  void index_rows(int first, int last, int delta);
 
   void run_autocomplete();
   void clear_autocomplete(bool force = false);
@@ -3,11 +3,13 @@
 #include "files.h"
 #include "input.h"
 #include "keybindings.h"
+#include "scheduler.h"
 #include "textmate.h"
 #include "treesitter.h"
 #include "utf8.h"
 
 #include <algorithm>
+#include <set>
 
 editor_t::editor_t()
     : view_t(), request_treesitter(false), request_autocomplete(false),
@@ -17,6 +19,31 @@ editor_t::editor_t()
   doc->initialize(Document::empty());
 }
 
+editor_t::~editor_t() { Scheduler::instance()->cancel(this); }
+
+// commands that are still allowed while the document tail is loading
+static bool is_read_only_command(std::string command) {
+  static std::set<std::string> commands = {"cancel",
+                                           "copy",
+                                           "select_word",
+                                           "select_all",
+                                           "select_line",
+                                           "toggle_wrap",
+                                           "move_up",
+                                           "move_down",
+                                           "move_left",
+                                           "move_right",
+                                           "pageup",
+                                           "pagedown",
+                                           "move_to_start_of_line",
+                                           "move_to_end_of_line",
+                                           "add_cursor_and_move_up",
+                                           "add_cursor_and_move_down",
+                                           "move_to_previous_word",
+                                           "move_to_next_word"};
+  return commands.find(command) != commands.end();
+}
+
 bool editor_t::on_input(int ch, std::string key_sequence) {
   AutoCompletePtr autocomplete = doc->autocomplete();
   SearchPtr search = doc->search();
@@ -29,6 +56,11 @@ bool editor_t::on_input(int ch, std::string key_sequence) {
   }
   last_key_sequence = "";
 
+  if (doc->is_loading() && !is_read_only_command(cmd.command)) {
+    update_scroll();
+    return false;
+  }
+
   if (cmd.command == "save") {
     if (doc->file_path != "") {
       if (doc->save(doc->file_path)) {
@@ -66,6 +98,15 @@ bool editor_t::on_input(int ch, std::string key_sequence) {
     doc->paste();
     request_treesitter = true;
   }
+  if (key_sequence == "paste") {
+    // bracketed paste, inserted as is in one edit
+    std::string &text = InputDecoder::instance()->paste;
+    if (text.size()) {
+      doc->insert_text(string_to_u16string(text));
+      text.clear();
+      request_treesitter = true;
+    }
+  }
   if (cmd.command == "select_word") {
     doc->add_cursor_from_selected_word();
   }
@@ -120,6 +161,12 @@ bool editor_t::on_input(int ch, std::string key_sequence) {
   if (cmd.command == "toggle_block_fold") {
     doc->toggle_fold(doc->cursor());
   }
+  if (cmd.command == "fold_all") {
+    doc->fold_all();
+  }
+  if (cmd.command == "unfold_all") {
+    doc->unfold_all();
+  }
   if (cmd.command == "selection_to_uppercase") {
     doc->selection_to_uppercase();
   }
@@ -223,49 +270,70 @@ bool editor_t::on_input(int ch, std::string key_sequence) {
     doc->clear_autocomplete();
   }
 
+  // every command is its own undo step, typing runs are coalesced
+  doc->commit_undo();
+
+  schedule_idle();
   update_scroll();
   return false;
 }
 
 #include "util.h"
 
-bool editor_t::on_idle(int frame) {
-  if (frame == 500 && request_treesitter) {
-    if (!doc->has_pending_treesitters()) {
-      // log("request_treesitter");
-      doc->run_treesitter();
-      request_treesitter = false;
-      return true;
-    } else {
-      // this would almost be impossible to happen
-      // log("treesitter .. defer");
-    }
-  }
-  if (frame == 750 && request_autocomplete) {
-    doc->clear_autocomplete(true);
-    doc->run_autocomplete();
-    request_autocomplete = false;
-    return true;
-  }
-  if (frame == 1500) {
-    AutoCompletePtr autocomplete = doc->autocomplete();
-    if (autocomplete && autocomplete->state != AutoComplete::State::Consumed) {
-      autocomplete->set_consumed();
-      return true;
-    }
-  }
-  if (frame == 850) {
-    SearchPtr search = doc->search();
-    if (search && search->state != Search::State::Consumed) {
-      search->set_consumed();
-      return true;
-    }
-  }
-
-  if (frame == 1000) {
-    doc->commit_undo();
+// defers the work an input leaves behind, debouncing pushes the deadlines
+// out again while otherwise only the missing tasks are added
+void editor_t::schedule_idle(bool debounce) {
+  Scheduler *scheduler = Scheduler::instance();
+  if (request_treesitter &&
+      (debounce || !scheduler->is_scheduled(this, "treesitter"))) {
+    scheduler->schedule(this, "treesitter", EDITOR_IDLE_TREESITTER,
+                        Scheduler::Normal, [this]() {
+                          if (!request_treesitter || doc->is_loading()) {
+                            return false;
+                          }
+                          doc->run_treesitter();
+                          request_treesitter = false;
+                          return true;
+                        });
+  }
+  if (request_autocomplete &&
+      (debounce || !scheduler->is_scheduled(this, "autocomplete"))) {
+    scheduler->schedule(this, "autocomplete", EDITOR_IDLE_AUTOCOMPLETE,
+                        Scheduler::High, [this]() {
+                          if (!request_autocomplete) {
+                            return false;
+                          }
+                          doc->clear_autocomplete(true);
+                          doc->run_autocomplete();
+                          request_autocomplete = false;
+                          return true;
+                        });
+  }
+  if (debounce || !scheduler->is_scheduled(this, "search_done")) {
+    scheduler->schedule(this, "search_done", EDITOR_IDLE_SEARCH,
+                        Scheduler::Low, [this]() {
+                          SearchPtr search = doc->search();
+                          if (search &&
+                              search->state != Search::State::Consumed) {
+                            search->set_consumed();
+                            return true;
+                          }
+                          return false;
+                        });
+  }
+  if (debounce || !scheduler->is_scheduled(this, "autocomplete_done")) {
+    scheduler->schedule(
+        this, "autocomplete_done", EDITOR_IDLE_AUTOCOMPLETE_DONE,
+        Scheduler::Low, [this]() {
+          AutoCompletePtr autocomplete = doc->autocomplete();
+          if (autocomplete &&
+              autocomplete->state != AutoComplete::State::Consumed) {
+            autocomplete->set_consumed();
+            return true;
+          }
+          return false;
+        });
   }
-  return false;
 }
 
 void editor_t::update_scroll() {
@@ -281,13 +349,10 @@ void editor_t::update_scroll() {
     if (s < 0)
       s = 0;
     for (int i = s; i < cursor.y; i++) {
-      BlockPtr block = doc->block_at(i);
-      for (auto f : doc->folds) {
-        if (is_point_within_range({i, 0}, f)) {
-          block = nullptr;
-          break;
-        }
+      if (doc->fold_index().is_hidden(i)) {
+        continue;
       }
+      BlockPtr block = doc->block_at(i);
       if (!block) {
         continue;
       }
@@ -296,16 +361,7 @@ void editor_t::update_scroll() {
   }
 
   // compute fold
-  int offset_folds = 0;
-  int prev_end = 0;
-  for (auto f : doc->folds) {
-    if (f.start.row < prev_end)
-      continue;
-    if (cursor.y > f.start.row) {
-      offset_folds += (f.end.row - f.start.row);
-    }
-    prev_end = f.end.row;
-  }
+  int offset_folds = doc->fold_index().hidden_before(cursor.y);
 
   // compute the scroll
   int size = doc->size();
@@ -383,9 +439,19 @@ bool textfield_t::on_input(int ch, std::string key_sequence) {
     return false;
   }
 
+  if (key_sequence == "paste") {
+    // a single line, the rest of a paste is dropped
+    std::string &text = InputDecoder::instance()->paste;
+    size_t eol = text.find('\n');
+    if (eol != std::string::npos) {
+      text.resize(eol);
+    }
+  }
+
   bool res = editor_t::on_input(ch, key_sequence);
   request_autocomplete = false;
   request_treesitter = false;
+  Scheduler::instance()->cancel(this);
   return res;
 }
 
@@ -417,7 +483,7 @@ editor_ptr editors_t::add_editor(std::string path) {
   e->request_treesitter = true;
 
   DocumentPtr doc = e->doc;
-  doc->load(path);
+  doc->load(path, true);
   int lang_id = Textmate::load_language(path);
   if (lang_id != -1) {
     doc->set_language(Textmate::language_info(lang_id));
@@ -8,12 +8,19 @@
 #include <memory>
 #include <string>
 
+// idle tasks, in ms after the last input
+#define EDITOR_IDLE_TREESITTER 50
+#define EDITOR_IDLE_AUTOCOMPLETE 75
+#define EDITOR_IDLE_SEARCH 85
+#define EDITOR_IDLE_AUTOCOMPLETE_DONE 150
+
 struct editor_t : view_t {
   editor_t();
+  ~editor_t();
 
-  bool on_idle(int frame);
   bool on_input(int ch, std::string key_sequence);
   void update_scroll();
+  void schedule_idle(bool debounce = true);
 
   DocumentPtr doc;
 
@@ -0,0 +1,111 @@
+#include "events.h"
+
+#include <signal.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#define EVENTS_MAX 8
+
+static void add_fd(int epoll_fd, int fd) {
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+// ms < 0 disarms, a zero interval fires once
+static void arm_timer(int fd, int ms, int interval) {
+  struct itimerspec spec = {};
+  if (ms >= 0) {
+    spec.it_value.tv_sec = ms / 1000;
+    spec.it_value.tv_nsec = (ms % 1000) * 1000 * 1000;
+    if (ms == 0) {
+      spec.it_value.tv_nsec = 1;
+    }
+    spec.it_interval.tv_sec = interval / 1000;
+    spec.it_interval.tv_nsec = (interval % 1000) * 1000 * 1000;
+  }
+  timerfd_settime(fd, 0, &spec, NULL);
+}
+
+static void drain(int fd) {
+  uint64_t count;
+  while (read(fd, &count, sizeof(count)) > 0) {
+  }
+}
+
+// must run before any thread is started so that SIGWINCH stays blocked
+// everywhere and only ever shows up on the signalfd
+EventLoop::EventLoop() : poll_interval(-1) {
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGWINCH);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  idle_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  poll_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+  add_fd(epoll_fd, STDIN_FILENO);
+  add_fd(epoll_fd, wake_fd);
+  add_fd(epoll_fd, signal_fd);
+  add_fd(epoll_fd, idle_fd);
+  add_fd(epoll_fd, poll_fd);
+}
+
+EventLoop::~EventLoop() {
+  close(poll_fd);
+  close(idle_fd);
+  close(signal_fd);
+  close(wake_fd);
+  close(epoll_fd);
+}
+
+void EventLoop::set_idle_timer(int ms) { arm_timer(idle_fd, ms, 0); }
+
+void EventLoop::set_poll_timer(int ms) {
+  if (ms == poll_interval) {
+    return;
+  }
+  poll_interval = ms;
+  arm_timer(poll_fd, ms, ms);
+}
+
+// blocks until at least one event, returns them as a mask
+int EventLoop::wait() {
+  struct epoll_event events[EVENTS_MAX];
+  int n = epoll_wait(epoll_fd, events, EVENTS_MAX, -1);
+  if (n < 0) {
+    return 0;
+  }
+
+  int res = 0;
+  for (int i = 0; i < n; i++) {
+    int fd = events[i].data.fd;
+    if (fd == STDIN_FILENO) {
+      // left for readKey
+      res |= Input;
+    } else if (fd == wake_fd) {
+      drain(fd);
+      res |= Wake;
+    } else if (fd == signal_fd) {
+      struct signalfd_siginfo info;
+      while (read(fd, &info, sizeof(info)) > 0) {
+      }
+      res |= Resize;
+    } else if (fd == idle_fd) {
+      drain(fd);
+      res |= Idle;
+    } else if (fd == poll_fd) {
+      drain(fd);
+      res |= Poll;
+    }
+  }
+  return res;
+}
@@ -0,0 +1,35 @@
+#ifndef TE_EVENTS_H
+#define TE_EVENTS_H
+
+// Waits on everything the main loop reacts to: keyboard input on stdin, the
+// eventfd background workers signal when they publish results, SIGWINCH,
+// a one-shot timer for debounced idle tasks and a periodic timer that only
+// runs while something still has to be polled. When none of them fire the
+// editor sleeps.
+class EventLoop {
+public:
+  enum Event {
+    Input = 1 << 0,
+    Wake = 1 << 1,
+    Resize = 1 << 2,
+    Idle = 1 << 3,
+    Poll = 1 << 4
+  };
+
+  EventLoop();
+  ~EventLoop();
+
+  int epoll_fd;
+  int wake_fd;
+  int signal_fd;
+  int idle_fd;
+  int poll_fd;
+  int poll_interval;
+
+  void set_idle_timer(int ms);
+  void set_poll_timer(int ms);
+
+  int wait();
+};
+
+#endif // TE_EVENTS_H
@@ -0,0 +1,227 @@
+#include "executor.h"
+#include "util.h"
+
+#include <stdint.h>
+#include <thread>
+#include <unistd.h>
+
+#define EXECUTOR_MIN_THREADS 2
+#define EXECUTOR_MAX_THREADS 8
+
+// worker of the calling thread, jobs submitted from a job stay local
+static thread_local Worker *current_worker = 0;
+
+static void *worker_thread(void *arg) {
+  Worker *worker = (Worker *)arg;
+  Executor *executor = worker->executor;
+  current_worker = worker;
+
+  while (!executor->stopping) {
+    Job job;
+    int priority;
+    if (executor->take(worker, job, priority)) {
+      executor->finish(priority, job);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(executor->sleep_mutex);
+    executor->wake.wait(lock, [executor] {
+      return executor->stopping || executor->pending > 0;
+    });
+  }
+  return NULL;
+}
+
+Executor::Executor(int threads)
+    : next(0), stopping(false), stopped(false), pending(0), notify_fd(-1) {
+  if (threads <= 0) {
+    threads = std::thread::hardware_concurrency() - 1;
+  }
+  if (threads < EXECUTOR_MIN_THREADS) {
+    threads = EXECUTOR_MIN_THREADS;
+  }
+  if (threads > EXECUTOR_MAX_THREADS) {
+    threads = EXECUTOR_MAX_THREADS;
+  }
+  for (int i = 0; i < 3; i++) {
+    queued[i] = 0;
+    completed[i] = 0;
+    total_latency[i] = 0;
+    max_latency[i] = 0;
+  }
+  for (int i = 0; i < threads; i++) {
+    Worker *worker = new Worker();
+    worker->executor = this;
+    worker->index = i;
+    workers.push_back(worker);
+  }
+  for (auto worker : workers) {
+    pthread_create(&worker->thread, NULL, &worker_thread, (void *)worker);
+  }
+}
+
+Executor::~Executor() {
+  shutdown();
+  for (auto worker : workers) {
+    delete worker;
+  }
+}
+
+// waits for the running jobs and drops the queued ones along with results
+// not delivered yet; called from the ui thread while the documents the jobs
+// refer to are still alive
+void Executor::shutdown() {
+  if (stopped) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto worker : workers) {
+    pthread_join(worker->thread, NULL);
+  }
+  stopped = true;
+  log_stats();
+
+  std::function<void()> result;
+  for (auto worker : workers) {
+    for (int i = 0; i < 3; i++) {
+      worker->queues[i].clear();
+    }
+    while (worker->results.pop(result)) {
+    }
+  }
+  results.clear();
+  pending = 0;
+}
+
+Executor *Executor::instance() {
+  static Executor executor;
+  return &executor;
+}
+
+void Executor::submit(std::function<void()> run, Priority priority) {
+  Worker *worker = current_worker;
+  if (!worker || worker->executor != this) {
+    worker = workers[next++ % workers.size()];
+  }
+  {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    worker->queues[priority].push_back(
+        Job{run, std::chrono::steady_clock::now()});
+  }
+  queued[priority]++;
+  {
+    // under the sleep lock so that a worker about to wait cannot miss it
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    pending++;
+  }
+  wake.notify_one();
+}
+
+bool Executor::take(Worker *worker, Job &job, int &priority) {
+  for (priority = Interactive; priority <= Background; priority++) {
+    {
+      std::lock_guard<std::mutex> lock(worker->mutex);
+      std::deque<Job> &own = worker->queues[priority];
+      if (!own.empty()) {
+        job = std::move(own.front());
+        own.pop_front();
+        pending--;
+        return true;
+      }
+    }
+    for (size_t i = 1; i < workers.size(); i++) {
+      Worker *victim = workers[(worker->index + i) % workers.size()];
+      std::lock_guard<std::mutex> lock(victim->mutex);
+      std::deque<Job> &theirs = victim->queues[priority];
+      if (!theirs.empty()) {
+        job = std::move(theirs.back());
+        theirs.pop_back();
+        pending--;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void Executor::finish(int priority, Job &job) {
+  uint64_t latency = std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::steady_clock::now() - job.queued)
+                         .count();
+  queued[priority]--;
+  uint64_t max = max_latency[priority];
+  while (latency > max &&
+         !max_latency[priority].compare_exchange_weak(max, latency)) {
+  }
+
+  job.run();
+  total_latency[priority] += latency;
+  completed[priority]++;
+}
+
+// called by a job once its output is complete, the result runs later on the
+// ui thread and must not touch anything the job still owns
+void Executor::publish(std::function<void()> result) {
+  Worker *worker = current_worker;
+  if (!worker || worker->executor != this) {
+    std::lock_guard<std::mutex> lock(results_mutex);
+    results.push_back(result);
+  } else {
+    worker->results.push(result);
+  }
+
+  int fd = notify_fd;
+  if (fd >= 0) {
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) < 0) {
+      // counter saturated, the ui is awake anyway
+    }
+  }
+}
+
+// ui thread, returns the number of results handed over
+int Executor::deliver() {
+  int count = 0;
+  std::function<void()> result;
+  for (auto worker : workers) {
+    while (worker->results.pop(result)) {
+      result();
+      count++;
+    }
+  }
+  std::vector<std::function<void()>> others;
+  {
+    std::lock_guard<std::mutex> lock(results_mutex);
+    others.swap(results);
+  }
+  for (auto &r : others) {
+    r();
+    count++;
+  }
+  return count;
+}
+
+size_t Executor::queue_depth() { return pending; }
+
+ExecutorStats Executor::stats(Priority priority) {
+  ExecutorStats res;
+  res.queued = queued[priority];
+  res.completed = completed[priority];
+  res.average_latency =
+      res.completed ? (double)total_latency[priority] / res.completed / 1000
+                    : 0;
+  res.max_latency = (double)max_latency[priority] / 1000;
+  return res;
+}
+
+void Executor::log_stats() {
+  const char *names[] = {"interactive", "visible", "background"};
+  for (int i = Interactive; i <= Background; i++) {
+    ExecutorStats s = stats((Priority)i);
+    log("executor %s queued %ld done %ld latency avg %.2fms max %.2fms",
+        names[i], s.queued, s.completed, s.average_latency, s.max_latency);
+  }
+}
@@ -0,0 +1,92 @@
+#ifndef TE_EXECUTOR_H
+#define TE_EXECUTOR_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <pthread.h>
+#include <vector>
+
+#include "channel.h"
+
+class Executor;
+
+class Job {
+public:
+  std::function<void()> run;
+  std::chrono::steady_clock::time_point queued;
+};
+
+// jobs waiting in one worker's queues, one per priority
+class Worker {
+public:
+  Executor *executor;
+  int index;
+  pthread_t thread;
+
+  std::mutex mutex;
+  std::deque<Job> queues[3];
+
+  // finished results on their way to the ui thread
+  Channel<std::function<void()>> results;
+};
+
+class ExecutorStats {
+public:
+  size_t queued;    // waiting right now
+  size_t completed; // since start
+  double average_latency; // ms between submit and start
+  double max_latency;
+};
+
+// Fixed pool shared by every background service. Each worker runs its own
+// jobs oldest first and steals the newest from the others once it runs
+// dry; a worker always takes the most urgent priority available anywhere.
+class Executor {
+public:
+  enum Priority { Interactive, Visible, Background };
+
+  Executor(int threads = 0);
+  ~Executor();
+
+  static Executor *instance();
+
+  std::vector<Worker *> workers;
+  std::atomic<unsigned> next;
+  std::atomic<bool> stopping;
+  bool stopped;
+
+  std::mutex sleep_mutex;
+  std::condition_variable wake;
+  std::atomic<size_t> pending;
+
+  // eventfd written after each publish, -1 if nobody waits on it
+  std::atomic<int> notify_fd;
+
+  // results published outside of a worker
+  std::mutex results_mutex;
+  std::vector<std::function<void()>> results;
+
+  // metrics, per priority
+  std::atomic<size_t> queued[3];
+  std::atomic<size_t> completed[3];
+  std::atomic<uint64_t> total_latency[3]; // us
+  std::atomic<uint64_t> max_latency[3];   // us
+
+  void submit(std::function<void()> job, Priority priority);
+  bool take(Worker *worker, Job &job, int &priority);
+  void finish(int priority, Job &job);
+
+  void publish(std::function<void()> result);
+  int deliver();
+  void shutdown();
+
+  size_t queue_depth();
+  ExecutorStats stats(Priority priority);
+  void log_stats();
+};
+
+#endif // TE_EXECUTOR_H
@@ -1,17 +1,23 @@
 #include "files.h"
+#include "executor.h"
 #include "extensions/util.h"
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <limits.h>
-#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <algorithm>
 #include <cstring>
 
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
 #define MAX_PRELOAD_DEPTH 4
 #define MAX_PRELOAD_THREADS 8
 
@@ -34,6 +40,87 @@ std::string directory_path(std::string path, std::string name) {
   return path.substr(0, path.size() - name.size());
 }
 
+MappedFile::MappedFile() : data(0), size(0), fd(-1) {}
+
+MappedFile::~MappedFile() { close(); }
+
+bool MappedFile::open(std::string path) {
+  close();
+
+  fd = ::open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close();
+    return false;
+  }
+
+  size = st.st_size;
+  if (size == 0) {
+    // nothing to map; an empty file is still a valid file
+    return true;
+  }
+
+  void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED) {
+    close();
+    return false;
+  }
+  madvise(addr, size, MADV_SEQUENTIAL);
+  data = (const char *)addr;
+  return true;
+}
+
+void MappedFile::close() {
+  if (data) {
+    munmap((void *)data, size);
+  }
+  if (fd != -1) {
+    ::close(fd);
+  }
+  data = 0;
+  size = 0;
+  fd = -1;
+}
+
+ContentHash::ContentHash() : hash(FNV_OFFSET), word(0), pending(0) {}
+
+void ContentHash::update(const char *data, size_t length) {
+  // finish a word left over from the previous piece
+  while (pending > 0 && length > 0) {
+    word |= (uint64_t)(unsigned char)*data++ << (pending * 8);
+    length--;
+    if (++pending == 8) {
+      hash = (hash ^ word) * FNV_PRIME;
+      word = 0;
+      pending = 0;
+    }
+  }
+  while (length >= 8) {
+    uint64_t w;
+    memcpy(&w, data, 8);
+    hash = (hash ^ w) * FNV_PRIME;
+    data += 8;
+    length -= 8;
+  }
+  while (length > 0) {
+    word |= (uint64_t)(unsigned char)*data++ << (pending * 8);
+    length--;
+    pending++;
+  }
+}
+
+uint64_t ContentHash::value() {
+  uint64_t res = hash;
+  for (int i = 0; i < pending; i++) {
+    res = (res ^ ((word >> (i * 8)) & 0xff)) * FNV_PRIME;
+  }
+  return res;
+}
+
 static bool compare_files(FileItemPtr f1, FileItemPtr f2) {
   if (f1->is_directory && !f2->is_directory) {
     return true;
@@ -46,7 +133,7 @@ static bool compare_files(FileItemPtr f1, FileItemPtr f2) {
 
 FileItem::FileItem(std::string p)
     : state(State::Consumed), expanded(false), is_directory(false), depth(0),
-      thread_id(0), preloaded(false) {
+      preloaded(false) {
   set_path(p);
 }
 
@@ -67,20 +154,19 @@ void FileItem::keep_alive() {}
 
 bool FileItem::is_disposable() { return false; }
 
-void *filetem_thread(void *arg) {
-  FileItem *item = (FileItem *)arg;
-  item->files.clear();
-
+// reads the directory into its own list, the item itself is only
+// touched on the ui thread
+static void filetem_thread(std::string path, FileList &files) {
   DIR *dir;
   struct dirent *ent;
-  if ((dir = opendir(item->full_path.c_str())) != NULL) {
+  if ((dir = opendir(path.c_str())) != NULL) {
     while ((ent = readdir(dir)) != NULL) {
       if (ent->d_name[0] == '.') {
         continue;
       }
 
       std::string fn = ent->d_name;
-      std::string fp = item->full_path + "/" + fn;
+      std::string fp = path + "/" + fn;
 
       size_t pos = fp.find("//");
       if (pos != std::string::npos) {
@@ -90,21 +176,26 @@ void *filetem_thread(void *arg) {
       FileItemPtr file = std::make_shared<FileItem>(fp);
       file->is_directory = ent->d_type == DT_DIR;
 
-      item->files.push_back(file);
+      files.push_back(file);
     }
     closedir(dir);
   }
 
-  std::sort(item->files.begin(), item->files.end(), compare_files);
-
-  item->thread_id = 0;
-  item->set_ready();
-  return NULL;
+  std::sort(files.begin(), files.end(), compare_files);
 }
 
-void FileItem::run(FileItem *item) {
-  pthread_create((pthread_t *)&(item->thread_id), NULL, &filetem_thread,
-                 (void *)(item));
+void FileItem::run(FileItemPtr item) {
+  std::string path = item->full_path;
+  Executor::instance()->submit(
+      [item, path] {
+        FileList files;
+        filetem_thread(path, files);
+        Executor::instance()->publish([item, files] {
+          item->files = files;
+          item->set_ready();
+        });
+      },
+      Executor::Background);
 }
 
 Files::Files() { root = std::make_shared<FileItem>(""); }
@@ -133,7 +224,7 @@ void Files::load(std::string path) {
   }
 
   item->state = FileItem::State::Loading;
-  FileItem::run(item.get());
+  FileItem::run(item);
 }
 
 void Files::build_files(FileList &list, FileItemPtr node, int depth,
@@ -216,6 +307,8 @@ bool Files::update() {
             FileList added, removed;
             merge_files(f, item, added, removed);
             item->state = FileItem::State::Consumed;
+            // frees a slot for the preloads below
+            disposables.push_back(r.first);
             did_update = true;
             f->preloaded = true;
           }
@@ -1,6 +1,7 @@
 #ifndef TE_FILES_H
 #define TE_FILES_H
 
+#include <cstdint>
 #include <map>
 #include <memory>
 #include <string>
@@ -10,6 +11,36 @@ std::string base_name(std::string path);
 std::string expanded_path(std::string path);
 std::string directory_path(std::string path, std::string name);
 
+class MappedFile {
+public:
+  MappedFile();
+  ~MappedFile();
+
+  const char *data;
+  size_t size;
+
+  bool open(std::string path);
+  void close();
+
+private:
+  int fd;
+};
+
+// 64 bit FNV-1a over the raw bytes of a file, fed in any number of pieces.
+// Mixes a word at a time, so it is not the byte-wise FNV value.
+class ContentHash {
+public:
+  ContentHash();
+
+  void update(const char *data, size_t length);
+  uint64_t value();
+
+private:
+  uint64_t hash;
+  uint64_t word;
+  int pending;
+};
+
 class FileItem;
 typedef std::shared_ptr<FileItem> FileItemPtr;
 typedef std::vector<FileItemPtr> FileList;
@@ -32,12 +63,11 @@ public:
 
   FileList files;
 
-  long thread_id;
   bool preloaded;
 
   void set_path(std::string path);
 
-  static void run(FileItem *FileItem);
+  static void run(FileItemPtr item);
   void set_ready();
   void set_consumed();
   void keep_alive();
@@ -0,0 +1,135 @@
+#include "folds.h"
+#include "cursor.h"
+
+#include <algorithm>
+
+FoldIndex::FoldIndex() : dirty(false) {}
+
+void FoldIndex::make_dirty() { dirty = true; }
+
+bool FoldIndex::is_dirty() { return dirty; }
+
+void FoldIndex::build(std::vector<Cursor> &folds) {
+  dirty = false;
+  spans.clear();
+  ranges.clear();
+
+  std::vector<Range> sorted;
+  for (auto &f : folds) {
+    sorted.push_back(f);
+  }
+  std::sort(sorted.begin(), sorted.end(),
+            [](const Range &a, const Range &b) { return a.start < b.start; });
+
+  for (auto &r : sorted) {
+    if (ranges.size() > 0 && !(ranges.back().end < r.start)) {
+      if (ranges.back().end < r.end) {
+        ranges.back().end = r.end;
+      }
+    } else {
+      ranges.push_back(r);
+    }
+
+    // the first line of a fold stays visible
+    int start = r.start.row + 1;
+    int end = r.end.row;
+    if (end < start) {
+      continue;
+    }
+    if (spans.size() > 0 && start <= spans.back().end + 1) {
+      if (end > spans.back().end) {
+        spans.back().end = end;
+      }
+      continue;
+    }
+    int hidden = 0;
+    if (spans.size() > 0) {
+      FoldSpan &prev = spans.back();
+      hidden = prev.hidden_before + prev.end - prev.start + 1;
+    }
+    spans.push_back({start, end, hidden});
+  }
+}
+
+int FoldIndex::hidden_rows() {
+  if (spans.size() == 0) {
+    return 0;
+  }
+  FoldSpan &last = spans.back();
+  return last.hidden_before + last.end - last.start + 1;
+}
+
+// index of the last span starting at or before row, or -1
+int FoldIndex::span_at(int row) {
+  auto it = std::upper_bound(
+      spans.begin(), spans.end(), row,
+      [](int row, const FoldSpan &span) { return row < span.start; });
+  return (int)(it - spans.begin()) - 1;
+}
+
+bool FoldIndex::is_hidden(int row) {
+  int idx = span_at(row);
+  return idx >= 0 && row <= spans[idx].end;
+}
+
+bool FoldIndex::contains(Point point) {
+  auto it = std::upper_bound(
+      ranges.begin(), ranges.end(), point,
+      [](Point point, const Range &range) { return point < range.start; });
+  if (it == ranges.begin()) {
+    return false;
+  }
+  it--;
+  return !(it->end < point);
+}
+
+int FoldIndex::hidden_before(int row) {
+  int idx = span_at(row);
+  if (idx < 0) {
+    return 0;
+  }
+  FoldSpan &span = spans[idx];
+  if (row <= span.end) {
+    return span.hidden_before + row - span.start;
+  }
+  return span.hidden_before + span.end - span.start + 1;
+}
+
+int FoldIndex::hidden_after(int row) {
+  int idx = span_at(row + 1);
+  if (idx < 0 || spans[idx].start != row + 1) {
+    return 0;
+  }
+  return spans[idx].end - spans[idx].start + 1;
+}
+
+int FoldIndex::visual_to_buffer(int line) {
+  // last span whose first hidden row would sit at or above line
+  auto it = std::upper_bound(spans.begin(), spans.end(), line,
+                             [](int line, const FoldSpan &span) {
+                               return line < span.start - span.hidden_before;
+                             });
+  if (it == spans.begin()) {
+    return line;
+  }
+  it--;
+  return line + it->hidden_before + it->end - it->start + 1;
+}
+
+int FoldIndex::buffer_to_visual(int row) { return row - hidden_before(row); }
+
+int FoldIndex::visible_above(int row) {
+  int idx = span_at(row);
+  if (idx >= 0 && row <= spans[idx].end) {
+    return spans[idx].start - 1;
+  }
+  return row;
+}
+
+int FoldIndex::visible_below(int row) {
+  int idx = span_at(row);
+  if (idx >= 0 && row <= spans[idx].end) {
+    return spans[idx].end + 1;
+  }
+  return row;
+}
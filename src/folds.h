@@ -0,0 +1,52 @@
+#ifndef TE_FOLDS_H
+#define TE_FOLDS_H
+
+#include <core/range.h>
+#include <vector>
+
+class Cursor;
+
+// A run of consecutive hidden rows. Folds hide the rows after their first
+// line, overlapping and nested folds are merged into a single span.
+class FoldSpan {
+public:
+  int start;
+  int end;
+  int hidden_before; // hidden rows in all spans before this one
+};
+
+// Sorted, disjoint view of the document folds answering row queries in
+// O(log n). It is rebuilt lazily after the folds change.
+class FoldIndex {
+public:
+  FoldIndex();
+
+  void make_dirty();
+  bool is_dirty();
+  void build(std::vector<Cursor> &folds);
+
+  int hidden_rows();
+  bool is_hidden(int row);
+  bool contains(Point point);
+
+  // hidden rows above row
+  int hidden_before(int row);
+  // hidden rows directly below row, when row starts a fold
+  int hidden_after(int row);
+
+  int visual_to_buffer(int line);
+  int buffer_to_visual(int row);
+
+  // nearest visible row going up or down from a hidden row
+  int visible_above(int row);
+  int visible_below(int row);
+
+private:
+  bool dirty;
+  std::vector<FoldSpan> spans;
+  std::vector<Range> ranges;
+
+  int span_at(int row);
+};
+
+#endif // TE_FOLDS_H
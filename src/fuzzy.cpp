@@ -0,0 +1,199 @@
+#include "fuzzy.h"
+
+#include <algorithm>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+static inline char16_t to_lower(char16_t c) {
+  return (c >= u'A' && c <= u'Z') ? c + 32 : c;
+}
+
+static inline char16_t to_upper(char16_t c) {
+  return (c >= u'a' && c <= u'z') ? c - 32 : c;
+}
+
+static inline bool is_upper(char16_t c) { return c >= u'A' && c <= u'Z'; }
+
+//---------------
+// blocks
+// a candidate is matched one fixed-size block at a time: each query
+// character is compared against the whole block at once, giving a mask with
+// two bits per code unit, and consumed at the first match after the previous
+//---------------
+
+#if defined(__AVX2__)
+
+#define FUZZY_BLOCK 16
+
+typedef __m256i fuzzy_block_t;
+
+static inline fuzzy_block_t load_block(const char16_t *s) {
+  return _mm256_loadu_si256((const __m256i *)s);
+}
+
+static inline unsigned either_mask(fuzzy_block_t v, char16_t a, char16_t b) {
+  __m256i eq = _mm256_or_si256(_mm256_cmpeq_epi16(v, _mm256_set1_epi16(a)),
+                               _mm256_cmpeq_epi16(v, _mm256_set1_epi16(b)));
+  return (unsigned)_mm256_movemask_epi8(eq);
+}
+
+#elif defined(__SSE2__)
+
+#define FUZZY_BLOCK 8
+
+typedef __m128i fuzzy_block_t;
+
+static inline fuzzy_block_t load_block(const char16_t *s) {
+  return _mm_loadu_si128((const __m128i *)s);
+}
+
+static inline unsigned either_mask(fuzzy_block_t v, char16_t a, char16_t b) {
+  __m128i eq = _mm_or_si128(_mm_cmpeq_epi16(v, _mm_set1_epi16(a)),
+                            _mm_cmpeq_epi16(v, _mm_set1_epi16(b)));
+  return (unsigned)_mm_movemask_epi8(eq);
+}
+
+#endif
+
+//---------------
+// query
+//---------------
+
+FuzzyQuery::FuzzyQuery(const std::u16string &query) : text(query) {
+  for (auto c : query) {
+    lower += to_lower(c);
+    upper += to_upper(c);
+  }
+}
+
+bool FuzzyQuery::matches(const char16_t *candidate, size_t length) {
+  if (length < text.size()) {
+    return false;
+  }
+  size_t j = 0;
+#if defined(FUZZY_BLOCK)
+  char16_t tail[FUZZY_BLOCK] = {};
+  for (size_t at = 0; at < length && j < text.size(); at += FUZZY_BLOCK) {
+    size_t units = length - at;
+    const char16_t *block = candidate + at;
+    if (units < FUZZY_BLOCK) {
+      // never load past the end of the candidate, units after it are masked
+      memcpy(tail, block, units * sizeof(char16_t));
+      block = tail;
+    }
+    fuzzy_block_t v = load_block(block);
+    uint64_t valid = units < FUZZY_BLOCK ? (1ull << (units * 2)) - 1
+                                         : (1ull << (FUZZY_BLOCK * 2)) - 1;
+    while (j < text.size()) {
+      unsigned mask = either_mask(v, lower[j], upper[j]) & valid;
+      if (!mask) {
+        break;
+      }
+      // drop the matched unit and everything before it
+      int bit = __builtin_ctz(mask);
+      valid &= ~((2ull << (bit + 1)) - 1);
+      j++;
+    }
+  }
+#else
+  for (size_t i = 0; i < length && j < text.size(); i++) {
+    if (candidate[i] == lower[j] || candidate[i] == upper[j]) {
+      j++;
+    }
+  }
+#endif
+  return j == text.size();
+}
+
+// matches at the start of the candidate, of a word part (after '_', '/' or
+// at a lower to upper case step) and runs of consecutive matches score
+// higher, longer candidates score lower; negative when there is no match
+int FuzzyQuery::score(const char16_t *candidate, size_t length) {
+  if (!matches(candidate, length)) {
+    return -1;
+  }
+  if (text.size() == 0) {
+    return 0;
+  }
+  int score = 0;
+  int run = 0;
+  size_t j = 0;
+  for (size_t i = 0; i < length && j < text.size(); i++) {
+    char16_t c = candidate[i];
+    if (c != lower[j] && c != upper[j]) {
+      run = 0;
+      continue;
+    }
+    int bonus = 1 + run;
+    if (i == 0) {
+      bonus += 8;
+    } else {
+      char16_t prev = candidate[i - 1];
+      if (prev == u'_' || prev == u'/' || (is_upper(c) && !is_upper(prev))) {
+        bonus += 4;
+      }
+    }
+    if (c == text[j]) {
+      bonus++;
+    }
+    score += bonus;
+    run++;
+    j++;
+  }
+  int unmatched = length - text.size();
+  if (unmatched > 63) {
+    unmatched = 63;
+  }
+  return score * 64 - unmatched;
+}
+
+int FuzzyQuery::score(const std::u16string &candidate) {
+  return score(candidate.data(), candidate.size());
+}
+
+//---------------
+// top k
+//---------------
+
+bool compare_fuzzy_match(const FuzzyMatch &a, const FuzzyMatch &b) {
+  if (a.score != b.score) {
+    return a.score > b.score;
+  }
+  return a.text < b.text;
+}
+
+FuzzyTopK::FuzzyTopK(size_t k) : k(k) { heap.reserve(k); }
+
+// cheap rejection before the candidate text is copied
+bool FuzzyTopK::accepts(int score) {
+  return score >= 0 && (heap.size() < k || score >= heap.front().score);
+}
+
+void FuzzyTopK::push(const std::u16string &text, int score) {
+  if (!accepts(score) || k == 0) {
+    return;
+  }
+  FuzzyMatch m{text, score};
+  if (heap.size() < k) {
+    heap.push_back(m);
+    std::push_heap(heap.begin(), heap.end(), compare_fuzzy_match);
+    return;
+  }
+  if (!compare_fuzzy_match(m, heap.front())) {
+    return;
+  }
+  std::pop_heap(heap.begin(), heap.end(), compare_fuzzy_match);
+  heap.back() = m;
+  std::push_heap(heap.begin(), heap.end(), compare_fuzzy_match);
+}
+
+// best first, leaves the heap empty
+std::vector<FuzzyMatch> FuzzyTopK::take() {
+  std::sort_heap(heap.begin(), heap.end(), compare_fuzzy_match);
+  std::vector<FuzzyMatch> res;
+  res.swap(heap);
+  return res;
+}
@@ -0,0 +1,45 @@
+#ifndef TE_FUZZY_H
+#define TE_FUZZY_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class FuzzyMatch {
+public:
+  std::u16string text;
+  int score;
+};
+
+// Case insensitive subsequence query over any set of candidates, words or
+// paths alike. matches() is a vectorized filter, only candidates passing it
+// need to be scored.
+class FuzzyQuery {
+public:
+  FuzzyQuery(const std::u16string &query);
+
+  std::u16string text;
+  std::u16string lower;
+  std::u16string upper;
+
+  bool matches(const char16_t *candidate, size_t length);
+  int score(const char16_t *candidate, size_t length);
+  int score(const std::u16string &candidate);
+};
+
+// the k best matches seen so far, worst on top of the heap
+class FuzzyTopK {
+public:
+  FuzzyTopK(size_t k);
+
+  size_t k;
+  std::vector<FuzzyMatch> heap;
+
+  bool accepts(int score);
+  void push(const std::u16string &text, int score);
+  std::vector<FuzzyMatch> take();
+};
+
+bool compare_fuzzy_match(const FuzzyMatch &a, const FuzzyMatch &b);
+
+#endif // TE_FUZZY_H
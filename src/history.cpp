@@ -0,0 +1,376 @@
+#include "history.h"
+#include "files.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HISTORY_ENTRY 0x544e4548      // HENT
+#define HISTORY_CHECKPOINT 0x4b484348 // HCHK
+#define HISTORY_FRAME_SIZE 8
+
+static void put(std::string &out, const void *data, size_t size) {
+  out.append((const char *)data, size);
+}
+
+static bool get(const std::string &in, size_t &pos, void *data, size_t size) {
+  if (pos + size > in.size()) {
+    return false;
+  }
+  memcpy(data, in.data() + pos, size);
+  pos += size;
+  return true;
+}
+
+static bool write_all(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+    if (written <= 0) {
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+// appends one framed record, returns its offset
+static int64_t append_record(int fd, uint32_t type, const std::string &payload) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return HISTORY_NONE;
+  }
+  uint32_t length = payload.size();
+  std::string record;
+  put(record, &type, 4);
+  put(record, &length, 4);
+  record += payload;
+  put(record, &length, 4);
+  put(record, &type, 4);
+  if (!write_all(fd, record.data(), record.size())) {
+    return HISTORY_NONE;
+  }
+  return st.st_size;
+}
+
+static bool read_record(int fd, int64_t offset, uint32_t &type,
+                        std::string &payload) {
+  uint32_t frame[2];
+  if (pread(fd, frame, HISTORY_FRAME_SIZE, offset) != HISTORY_FRAME_SIZE) {
+    return false;
+  }
+  type = frame[0];
+  payload.resize(frame[1]);
+  return pread(fd, payload.data(), frame[1], offset + HISTORY_FRAME_SIZE) ==
+         (ssize_t)frame[1];
+}
+
+static std::string history_directory() {
+  const char *home = getenv("HOME");
+  if (!home) {
+    return "";
+  }
+  std::string dir = std::string(home) + "/.editor";
+  mkdir(dir.c_str(), 0755);
+  dir += "/history";
+  mkdir(dir.c_str(), 0755);
+  return dir;
+}
+
+History::History()
+    : base_hash(0), has_base_hash(false), base(HISTORY_UNRESOLVED),
+      evicted(0), writing(false), write_floor(0), write_stale(false) {}
+
+void History::open(std::string file_path) {
+  path = "";
+  has_base_hash = false;
+  base = HISTORY_UNRESOLVED;
+  offsets.clear();
+  evicted = 0;
+  writing = false;
+
+  char full_path[PATH_MAX];
+  if (!realpath(file_path.c_str(), full_path)) {
+    return;
+  }
+  std::string dir = history_directory();
+  if (dir == "") {
+    return;
+  }
+
+  ContentHash key;
+  key.update(full_path, strlen(full_path));
+  char name[32];
+  snprintf(name, sizeof(name), "/%016" PRIx64, key.value());
+  path = dir + name;
+}
+
+void History::set_base_hash(uint64_t hash) {
+  base_hash = hash;
+  has_base_hash = true;
+}
+
+// follows evictions and undos in the journal; evicted entries move the
+// base forward, which is only possible if they had been written already
+void History::sync(UndoJournal &journal) {
+  if (writing && journal.evicted() + journal.size() < write_floor) {
+    write_floor = journal.evicted() + journal.size();
+  }
+  size_t n = journal.evicted() - evicted;
+  evicted = journal.evicted();
+  if (n > 0 && base != HISTORY_BROKEN) {
+    if (offsets.size() >= n) {
+      base = offsets[n - 1];
+      offsets.erase(offsets.begin(), offsets.begin() + n);
+    } else {
+      base = HISTORY_BROKEN;
+      offsets.clear();
+    }
+  }
+  if (offsets.size() > journal.size()) {
+    offsets.resize(journal.size());
+  }
+}
+
+// the most recent checkpoint for the content hash, walking back
+// through the record frames
+static int64_t find_checkpoint(const std::string &path, uint64_t hash) {
+  int64_t found = HISTORY_NONE;
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return found;
+  }
+
+  struct stat st;
+  int64_t end = fstat(fd, &st) == 0 ? st.st_size : 0;
+  while (end >= 2 * HISTORY_FRAME_SIZE) {
+    uint32_t frame[2];
+    if (pread(fd, frame, HISTORY_FRAME_SIZE, end - HISTORY_FRAME_SIZE) !=
+        HISTORY_FRAME_SIZE) {
+      break;
+    }
+    int64_t start = end - 2 * HISTORY_FRAME_SIZE - frame[0];
+    if (start < 0) {
+      break;
+    }
+    if (frame[1] == HISTORY_CHECKPOINT) {
+      uint32_t type;
+      std::string payload;
+      size_t pos = 0;
+      uint64_t checkpoint_hash;
+      int64_t head;
+      if (read_record(fd, start, type, payload) &&
+          get(payload, pos, &checkpoint_hash, 8) &&
+          get(payload, pos, &head, 8) && checkpoint_hash == hash) {
+        found = head;
+        break;
+      }
+    }
+    end = start;
+  }
+
+  close(fd);
+  return found;
+}
+
+bool History::resolve() {
+  base = HISTORY_NONE;
+  if (path == "" || !has_base_hash) {
+    return false;
+  }
+  base = find_checkpoint(path, base_hash);
+  return base != HISTORY_NONE;
+}
+
+HistoryWrite::HistoryWrite()
+    : base_hash(0), has_base_hash(false), base(HISTORY_NONE), written(0),
+      evicted(0), truncated(false), head(HISTORY_BROKEN) {}
+
+// writes the entries chained to the base; runs on the saver worker
+void HistoryWrite::run() {
+  if (base == HISTORY_UNRESOLVED) {
+    base = has_base_hash ? find_checkpoint(path, base_hash) : HISTORY_NONE;
+  }
+
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (fd == -1) {
+    return;
+  }
+
+  // start over rather than grow without bound; entries written before
+  // this save are gone with it, so the next save writes the journal again
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > HISTORY_FILE_LIMIT) {
+    if (ftruncate(fd, 0) == 0) {
+      truncated = true;
+      base = HISTORY_NONE;
+      offsets.clear();
+      if (written > 0) {
+        close(fd);
+        return;
+      }
+    }
+  }
+
+  for (auto &entry : entries) {
+    int64_t prev = offsets.size() > 0 ? offsets.back() : base;
+    uint32_t count = entry.size();
+    std::string payload;
+    put(payload, &prev, 8);
+    put(payload, &count, 4);
+    for (auto &c : entry) {
+      uint32_t range[5] = {c.range.start.row, c.range.start.column,
+                           c.range.end.row, c.range.end.column,
+                           (uint32_t)c.old_text.size()};
+      put(payload, range, sizeof(range));
+      put(payload, c.old_text.data(), c.old_text.size() * sizeof(char16_t));
+    }
+    int64_t offset = append_record(fd, HISTORY_ENTRY, payload);
+    if (offset == HISTORY_NONE) {
+      break;
+    }
+    offsets.push_back(offset);
+  }
+
+  close(fd);
+  if (offsets.size() < written + entries.size()) {
+    return;
+  }
+  head = offsets.size() > 0 ? offsets.back() : base;
+}
+
+void HistoryWrite::checkpoint(uint64_t hash) {
+  if (head == HISTORY_BROKEN || head == HISTORY_UNRESOLVED) {
+    return;
+  }
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (fd == -1) {
+    return;
+  }
+  std::string payload;
+  put(payload, &hash, 8);
+  put(payload, &head, 8);
+  append_record(fd, HISTORY_CHECKPOINT, payload);
+  close(fd);
+}
+
+// copies out the journal entries not on disk yet; false if there is
+// nothing the side file can take
+bool History::prepare(UndoJournal &journal, HistoryWrite &write) {
+  if (path == "" || writing) {
+    return false;
+  }
+  journal.seal();
+  sync(journal);
+  if (base == HISTORY_BROKEN) {
+    return false;
+  }
+
+  write.path = path;
+  write.base_hash = base_hash;
+  write.has_base_hash = has_base_hash;
+  write.base = base;
+  write.offsets.assign(offsets.begin(), offsets.end());
+  write.written = offsets.size();
+  write.evicted = evicted;
+  journal.export_entries(offsets.size(), write.entries);
+
+  writing = true;
+  write_floor = evicted + journal.size();
+  write_stale = false;
+  return true;
+}
+
+// takes over the offsets the worker wrote, replaying the evictions and
+// undos the journal went through in the meantime
+void History::apply(HistoryWrite &write) {
+  writing = false;
+
+  if (write_stale || write_floor < evicted) {
+    // the journal no longer starts from what was written
+    if (write.truncated) {
+      base = HISTORY_BROKEN;
+      offsets.clear();
+    }
+    return;
+  }
+
+  size_t valid = write_floor - write.evicted;
+  std::vector<int64_t> written = write.offsets;
+  if (written.size() > valid) {
+    written.resize(valid);
+  }
+
+  size_t n = evicted - write.evicted;
+  offsets.clear();
+  if (n == 0) {
+    base = write.base;
+  } else if (written.size() >= n) {
+    base = written[n - 1];
+  } else {
+    base = HISTORY_BROKEN;
+    return;
+  }
+  offsets.insert(offsets.end(), written.begin() + n, written.end());
+}
+
+// the entry before the journal, newest delta first like UndoJournal::pop;
+// only valid while the journal is empty
+bool History::pop(std::vector<UndoChange> &changes) {
+  if (path == "") {
+    return false;
+  }
+  if (base == HISTORY_UNRESOLVED) {
+    resolve();
+  }
+  if (base < 0) {
+    return false;
+  }
+  if (writing) {
+    write_stale = true;
+  }
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  uint32_t type;
+  std::string payload;
+  bool ok = read_record(fd, base, type, payload) && type == HISTORY_ENTRY;
+  close(fd);
+
+  size_t pos = 0;
+  int64_t prev;
+  uint32_t count;
+  ok = ok && get(payload, pos, &prev, 8) && get(payload, pos, &count, 4);
+
+  std::vector<UndoChange> entry;
+  for (uint32_t i = 0; ok && i < count; i++) {
+    uint32_t range[5];
+    ok = get(payload, pos, range, sizeof(range));
+    if (!ok) {
+      break;
+    }
+    UndoChange c;
+    c.range = Range{Point{range[0], range[1]}, Point{range[2], range[3]}};
+    c.old_text.resize(range[4]);
+    ok = get(payload, pos, c.old_text.data(), range[4] * sizeof(char16_t));
+    entry.push_back(c);
+  }
+
+  if (!ok) {
+    log("history: unreadable entry in %s", path.c_str());
+    base = HISTORY_NONE;
+    return false;
+  }
+
+  changes.insert(changes.end(), entry.rbegin(), entry.rend());
+  base = prev;
+  return true;
+}
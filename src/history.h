@@ -0,0 +1,87 @@
+#ifndef TE_HISTORY_H
+#define TE_HISTORY_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "undo.h"
+
+#define HISTORY_FILE_LIMIT (64 * 1024 * 1024)
+
+#define HISTORY_NONE -1       // nothing older is known
+#define HISTORY_UNRESOLVED -2 // not looked up in the side file yet
+#define HISTORY_BROKEN -3     // the journal no longer connects to the file
+
+// Undo history kept across sessions in an append-only side file,
+// ~/.editor/history/<hash of the file path>.
+//
+// Every record is framed as [type][length] payload [length][type], so the
+// file can be walked from either end. Entry records hold the deltas of one
+// undo entry and the offset of the entry before them. Checkpoint records
+// tie the content hash of a saved file to the newest entry that led to it.
+//
+// Nothing is read when a document opens. The checkpoint matching the
+// loaded content is only looked up once an undo goes past the in-memory
+// journal, or by the saver on the first save.
+
+// The journal entries not on disk yet, copied out on the ui thread and
+// written by the saver worker together with the checkpoint of the save.
+class HistoryWrite {
+public:
+  HistoryWrite();
+
+  std::string path;
+  uint64_t base_hash;
+  bool has_base_hash;
+  int64_t base;
+  // entry records already written, extended by run()
+  std::vector<int64_t> offsets;
+  size_t written;
+  size_t evicted;
+  std::vector<std::vector<UndoChange>> entries;
+
+  // the side file was over its limit and started over
+  bool truncated;
+  // newest entry record, for the checkpoint
+  int64_t head;
+
+  void run();
+  void checkpoint(uint64_t hash);
+};
+
+class History {
+public:
+  History();
+
+  std::string path;
+  uint64_t base_hash;
+  bool has_base_hash;
+
+  // entry record of the state the journal starts from
+  int64_t base;
+  // entry records of the journal entries already written
+  std::deque<int64_t> offsets;
+  size_t evicted;
+
+  void open(std::string file_path);
+  void set_base_hash(uint64_t hash);
+
+  void sync(UndoJournal &journal);
+  bool prepare(UndoJournal &journal, HistoryWrite &write);
+  void apply(HistoryWrite &write);
+  bool pop(std::vector<UndoChange> &changes);
+
+private:
+  // set from prepare() until apply(); the journal may still change
+  bool writing;
+  // smallest evicted + size of the journal seen while writing
+  size_t write_floor;
+  // an undo went into the side file while writing
+  bool write_stale;
+
+  bool resolve();
+};
+
+#endif // TE_HISTORY_H
@@ -7,6 +7,8 @@
 #include <sys/ioctl.h>
 #include <unistd.h>
 
+#include <map>
+
 // if != 0, then there is data to be read on stdin
 int kbhit(int timeout) {
   // timeout structure passed into select
@@ -57,338 +59,270 @@ static int readMoreEscapeSequence(int c, std::string &keySequence) {
   return K_ESC;
 }
 
-static int readEscapeSequence(std::string &keySequence) {
-  keySequence = "";
-  std::string sequence = "";
+// escape sequences by the bytes after ESC
+static std::map<std::string, KeyEvent> &escape_table() {
+  static std::map<std::string, KeyEvent> table;
+  if (table.size()) {
+    return table;
+  }
 
-  char seq[4];
-  int wait = 500;
+  const char finals[] = {'A', 'B', 'C', 'D', 'H', 'F'};
+  const char *names[] = {"up", "down", "right", "left", "home", "end"};
+  const int plain[] = {KEY_UP, KEY_DOWN, KEY_RIGHT,
+                       KEY_LEFT, K_HOME_KEY, K_END_KEY};
+  for (int i = 0; i < 6; i++) {
+    table[std::string("[") + finals[i]] = KeyEvent{plain[i], names[i]};
+    table[std::string("O") + finals[i]] = KeyEvent{plain[i], names[i]};
+  }
 
-  if (!kbhit(wait)) {
-    return K_ESC;
+  table["[2~"] = KeyEvent{K_INSERT, "insert"};
+  table["[3~"] = KeyEvent{KEY_DC, "delete"};
+  table["[5~"] = KeyEvent{K_PAGE_UP, "pageup"};
+  table["[6~"] = KeyEvent{K_PAGE_DOWN, "pagedown"};
+
+  // CSI 1 ; modifier final
+  const char *modifiers[] = {"shift+",      "alt+",      "alt+shift+",
+                             "ctrl+",       "ctrl+shift+", "ctrl+alt+",
+                             "ctrl+shift+alt+"};
+  const int codes[7][6] = {
+      {KEY_SR, KEY_SF, KEY_SRIGHT, KEY_SLEFT, K_SHIFT_HOME, K_SHIFT_END},
+      {K_ALT_UP, K_ALT_DOWN, K_ALT_RIGHT, K_ALT_LEFT, K_ALT_HOME, K_ALT_END},
+      {K_ALT_UP, K_ALT_DOWN, K_ALT_RIGHT, K_ALT_LEFT, K_ALT_HOME, K_ALT_END},
+      {K_CTRL_UP, K_CTRL_DOWN, K_CTRL_RIGHT, K_CTRL_LEFT, K_CTRL_HOME,
+       K_CTRL_END},
+      {K_CTRL_SHIFT_UP, K_CTRL_SHIFT_DOWN, K_CTRL_SHIFT_RIGHT,
+       K_CTRL_SHIFT_LEFT, K_CTRL_SHIFT_HOME, K_CTRL_SHIFT_END},
+      {K_CTRL_ALT_UP, K_CTRL_ALT_DOWN, K_CTRL_ALT_RIGHT, K_CTRL_ALT_LEFT,
+       K_CTRL_ALT_HOME, K_CTRL_ALT_END},
+      {KEY_SR, KEY_SF, K_CTRL_SHIFT_ALT_RIGHT, K_CTRL_SHIFT_ALT_LEFT,
+       K_CTRL_SHIFT_ALT_HOME, K_CTRL_SHIFT_ALT_END}};
+  for (int m = 0; m < 7; m++) {
+    for (int i = 0; i < 6; i++) {
+      std::string key = "[1;";
+      key += (char)('2' + m);
+      key += finals[i];
+      table[key] = KeyEvent{codes[m][i], std::string(modifiers[m]) + names[i]};
+    }
   }
-  read(STDIN_FILENO, &seq[0], 1);
+  return table;
+}
 
-  // printf(">%d\n", seq[0]);
+static int decode_byte(char c, std::string &keySequence) {
+  switch (c) {
+  case K_TAB:
+    keySequence = "tab";
+    return K_TAB;
+  case K_ENTER:
+    keySequence = "enter";
+    return c;
+  case K_BACKSPACE:
+  case KEY_BACKSPACE:
+    keySequence = "backspace";
+    return c;
+  case K_RESIZE:
+  case KEY_RESIZE:
+    keySequence = "resize";
+    return c;
+  }
 
-  if (!kbhit(wait)) {
-    return readMoreEscapeSequence(seq[0], keySequence);
+  if (CTRL_KEY(c) == c) {
+    keySequence = "ctrl+";
+    c = 'a' + (c - 1);
+    if (c >= 'a' && c <= 'z') {
+      keySequence += c;
+      return c;
+    } else {
+      switch (c) {
+      case 96:
+        keySequence += '`';
+        break;
+      case 127:
+        keySequence += '/';
+        break;
+      case 124:
+        keySequence += '\\';
+        break;
+      default:
+        keySequence += '?';
+        break;
+      }
+      // printf("ctrl+%d\n", c);
+    }
+    return c;
   }
-  read(STDIN_FILENO, &seq[1], 1);
 
-  /* ESC [ sequences. */
-  if (seq[0] == '[') {
+  return c;
+}
+
+InputDecoder::InputDecoder() : offset(0), escape_wait(INPUT_ESCAPE_WAIT) {}
 
-    if (seq[1] >= '0' && seq[1] <= '9') {
+InputDecoder *InputDecoder::instance() {
+  static InputDecoder decoder;
+  return &decoder;
+}
+
+// one read for whatever the terminal has buffered
+size_t InputDecoder::fill(int fd) {
+  char tmp[INPUT_BUFFER_SIZE];
+  ssize_t n = read(fd, tmp, sizeof(tmp));
+  if (n <= 0) {
+    return 0;
+  }
+  buffer.append(tmp, n);
+  return n;
+}
 
-      /* Extended escape, read additional byte. */
-      if (!kbhit(wait)) {
-        return K_ESC;
+void InputDecoder::feed(std::string bytes) { buffer += bytes; }
+
+// length of the escape sequence at offset, 0 if it is cut short
+size_t InputDecoder::scan_escape(size_t start) {
+  enum State { Escape, CSI, SS3 };
+  State state = Escape;
+  for (size_t i = start + 1; i < buffer.size(); i++) {
+    unsigned char c = buffer[i];
+    switch (state) {
+    case Escape:
+      if (c == '[') {
+        state = CSI;
+      } else if (c == 'O') {
+        state = SS3;
+      } else {
+        return i + 1 - start;
       }
-      read(STDIN_FILENO, &seq[2], 1);
-
-      if (seq[2] == '~') {
-        switch (seq[1]) {
-        case '3':
-          keySequence = "delete";
-          return KEY_DC;
-        case '5':
-          keySequence = "pageup";
-          return K_PAGE_UP;
-        case '6':
-          keySequence = "pagedown";
-          return K_PAGE_DOWN;
-        }
+      break;
+    case CSI:
+      // parameters until a final byte
+      if (c >= 0x40 && c <= 0x7e) {
+        return i + 1 - start;
       }
-
-      if (seq[2] == ';') {
-        if (!kbhit(wait)) {
-          return K_ESC;
-        }
-        read(STDIN_FILENO, &seq[0], 1);
-        if (!kbhit(wait)) {
-          return K_ESC;
-        }
-
-        read(STDIN_FILENO, &seq[1], 1);
-
-        // printf(">%c %c\n", seq[0], seq[1]);
-
-        sequence = "shift+";
-        if (seq[0] == '2') {
-          // printf("shift+%d\n", seq[1]);
-          switch (seq[1]) {
-          case 'A':
-            keySequence = sequence + "up";
-            return KEY_SR;
-          case 'B':
-            keySequence = sequence + "down";
-            return KEY_SF;
-          case 'C':
-            keySequence = sequence + "right";
-            return KEY_SRIGHT;
-          case 'D':
-            keySequence = sequence + "left";
-            return KEY_SLEFT;
-          case 'H':
-            keySequence = sequence + "home";
-            return K_SHIFT_HOME;
-          case 'F':
-            keySequence = sequence + "end";
-            return K_SHIFT_END;
-          }
-        }
-
-        sequence = "alt+";
-        if (seq[0] == '3') {
-          // printf("alt+%c\n", seq[1]);
-          switch (seq[1]) {
-          case 'A':
-            keySequence = sequence + "up";
-            return K_ALT_UP;
-          case 'B':
-            keySequence = sequence + "down";
-            return K_ALT_DOWN;
-          case 'C':
-            keySequence = sequence + "right";
-            return K_ALT_RIGHT;
-          case 'D':
-            keySequence = sequence + "left";
-            return K_ALT_LEFT;
-          case 'H':
-            keySequence = sequence + "home";
-            return K_ALT_HOME;
-          case 'F':
-            keySequence = sequence + "end";
-            return K_ALT_END;
-          }
-        }
-        sequence = "alt+shift+";
-        if (seq[0] == '4') {
-          // printf("alt+shift+%c\n", seq[1]);
-          switch (seq[1]) {
-          case 'A':
-            keySequence = sequence + "up";
-            return K_ALT_UP;
-          case 'B':
-            keySequence = sequence + "down";
-            return K_ALT_DOWN;
-          case 'C':
-            keySequence = sequence + "right";
-            return K_ALT_RIGHT;
-          case 'D':
-            keySequence = sequence + "left";
-            return K_ALT_LEFT;
-          case 'H':
-            keySequence = sequence + "home";
-            return K_ALT_HOME;
-          case 'F':
-            keySequence = sequence + "end";
-            return K_ALT_END;
-          }
-        }
-
-        sequence = "ctrl+";
-        if (seq[0] == '5') {
-          // printf("ctrl+%d\n", seq[1]);
-          switch (seq[1]) {
-          case 'A':
-            keySequence = sequence + "up";
-            return K_CTRL_UP;
-          case 'B':
-            keySequence = sequence + "down";
-            return K_CTRL_DOWN;
-          case 'C':
-            keySequence = sequence + "right";
-            return K_CTRL_RIGHT;
-          case 'D':
-            keySequence = sequence + "left";
-            return K_CTRL_LEFT;
-          case 'H':
-            keySequence = sequence + "home";
-            return K_CTRL_HOME;
-          case 'F':
-            keySequence = sequence + "end";
-            return K_CTRL_END;
-          }
-        }
-
-        sequence = "ctrl+shift+";
-        if (seq[0] == '6') {
-          // printf("ctrl+shift+%d\n", seq[1]);
-          switch (seq[1]) {
-          case 'A':
-            keySequence = sequence + "up";
-            return K_CTRL_SHIFT_UP;
-          case 'B':
-            keySequence = sequence + "down";
-            return K_CTRL_SHIFT_DOWN;
-          case 'C':
-            keySequence = sequence + "right";
-            return K_CTRL_SHIFT_RIGHT;
-          case 'D':
-            keySequence = sequence + "left";
-            return K_CTRL_SHIFT_LEFT;
-          case 'H':
-            keySequence = sequence + "home";
-            return K_CTRL_SHIFT_HOME;
-          case 'F':
-            keySequence = sequence + "end";
-            return K_CTRL_SHIFT_END;
-          }
-        }
-
-        sequence = "ctrl+alt+";
-        if (seq[0] == '7') {
-          // printf("ctrl+alt+%d\n", seq[1]);
-          switch (seq[1]) {
-          case 'A':
-            keySequence = sequence + "up";
-            return K_CTRL_ALT_UP;
-          case 'B':
-            keySequence = sequence + "down";
-            return K_CTRL_ALT_DOWN;
-          case 'C':
-            keySequence = sequence + "right";
-            return K_CTRL_ALT_RIGHT;
-          case 'D':
-            keySequence = sequence + "left";
-            return K_CTRL_ALT_LEFT;
-          case 'H':
-            keySequence = sequence + "home";
-            return K_CTRL_ALT_HOME;
-          case 'F':
-            keySequence = sequence + "end";
-            return K_CTRL_ALT_END;
-          }
-        }
-
-        sequence = "ctrl+shift+alt+";
-        if (seq[0] == '8') {
-          // printf("ctrl+shift+alt+%d\n", seq[1]);
-          switch (seq[1]) {
-          case 'A':
-            keySequence = sequence + "up";
-            return KEY_SR;
-          case 'B':
-            keySequence = sequence + "down";
-            return KEY_SF;
-          case 'C':
-            keySequence = sequence + "right";
-            return K_CTRL_SHIFT_ALT_RIGHT;
-          case 'D':
-            keySequence = sequence + "left";
-            return K_CTRL_SHIFT_ALT_LEFT;
-          case 'H':
-            keySequence = sequence + "home";
-            return K_CTRL_SHIFT_ALT_HOME;
-          case 'F':
-            keySequence = sequence + "end";
-            return K_CTRL_SHIFT_ALT_END;
-          }
-        }
-
-        return K_ESC;
+      if (c < 0x20 || i - start > INPUT_ESCAPE_MAX) {
+        return i - start;
       }
+      break;
+    case SS3:
+      return i + 1 - start;
     }
   }
+  return 0;
+}
 
-  if (seq[0] == '[' || seq[0] == 'O') {
-    switch (seq[1]) {
-    case 'A':
-      keySequence = "up";
-      return KEY_UP;
-    case 'B':
-      keySequence = "down";
-      return KEY_DOWN;
-    case 'C':
-      keySequence = "right";
-      return KEY_RIGHT;
-    case 'D':
-      keySequence = "left";
-      return KEY_LEFT;
-    case 'H':
-      keySequence = "home";
-      return K_HOME_KEY;
-    case 'F':
-      keySequence = "end";
-      return K_END_KEY;
-    case '2':
-      keySequence = "insert";
-      return K_INSERT;
-    }
+// the rest of the buffer is the start of a paste marker, at least ESC[20
+bool InputDecoder::is_paste_prefix(size_t start) {
+  size_t length = buffer.size() - start;
+  return length >= 4 && length < sizeof(INPUT_PASTE_BEGIN) - 1 &&
+         buffer.compare(start, length, INPUT_PASTE_BEGIN, length) == 0;
+}
 
-    // printf("escape+%c+%c\n", seq[0], seq[1]);
+// the text up to the end marker, false until all of it has arrived
+bool InputDecoder::scan_paste(size_t start, KeyEvent &key) {
+  size_t begin = start + sizeof(INPUT_PASTE_BEGIN) - 1;
+  size_t end = buffer.find(INPUT_PASTE_END, begin);
+  if (end == std::string::npos) {
+    return false;
   }
 
-  /* ESC O sequences. */
-  // else if (seq[0] == 'O') {
-  //     printf("escape+O+%d\n", seq[1]);
-  //     switch (seq[1]) {
-  //     case 'H':
-  //         return K_HOME_KEY;
-  //     case 'F':
-  //         return K_END_KEY;
-  //     }
-  // }
-
-  return K_ESC;
+  key.key = K_PASTE;
+  key.sequence = "paste";
+  key.text.clear();
+  key.text.reserve(end - begin);
+  // terminals send line breaks as carriage returns
+  for (size_t i = begin; i < end; i++) {
+    char c = buffer[i];
+    if (c == '\r') {
+      if (i + 1 < end && buffer[i + 1] == '\n') {
+        continue;
+      }
+      c = '\n';
+    }
+    key.text += c;
+  }
+  offset = end + sizeof(INPUT_PASTE_END) - 1;
+  return true;
 }
 
-int readKey(std::string &keySequence) {
-  if (kbhit(100) != 0) {
-    char c;
-    if (read(STDIN_FILENO, &c, 1) != 0) {
+// queues every complete key in the buffer, a paste still arriving stays
+void InputDecoder::decode() {
+  while (offset < buffer.size()) {
+    char c = buffer[offset];
+    KeyEvent key{-1, ""};
+
+    if (c != K_ESC) {
+      key.key = decode_byte(c, key.sequence);
+      offset++;
+      keys.push_back(key);
+      continue;
+    }
 
-      if (c == K_ESC) {
-        return readEscapeSequence(keySequence);
+    size_t length = scan_escape(offset);
+    if (length == 0) {
+      // give the rest of a split sequence a moment to arrive
+      if (escape_wait > 0 && kbhit(escape_wait) && fill(STDIN_FILENO) > 0) {
+        continue;
       }
-
-      switch (c) {
-      case K_TAB:
-        keySequence = "tab";
-        return K_TAB;
-      case K_ENTER:
-        keySequence = "enter";
-        return c;
-      case K_BACKSPACE:
-      case KEY_BACKSPACE:
-        keySequence = "backspace";
-        return c;
-      case K_RESIZE:
-      case KEY_RESIZE:
-        keySequence = "resize";
-        return c;
+      // nor is a paste start marker cut short a key, the paste follows
+      if (is_paste_prefix(offset)) {
+        break;
       }
+      length = buffer.size() - offset;
+    }
 
-      if (CTRL_KEY(c) == c) {
-        keySequence = "ctrl+";
-        c = 'a' + (c - 1);
-        if (c >= 'a' && c <= 'z') {
-          keySequence += c;
-          return c;
-        } else {
-          switch (c) {
-          case 96:
-            keySequence += '`';
-            break;
-          case 127:
-            keySequence += '/';
-            break;
-          case 124:
-            keySequence += '\\';
-            break;
-          default:
-            keySequence += '?';
-            break;
-          }
-          // printf("ctrl+%d\n", c);
-        }
-        return c;
+    std::string sequence = buffer.substr(offset + 1, length - 1);
+    if (sequence == INPUT_PASTE_BEGIN + 1) {
+      if (!scan_paste(offset, key)) {
+        break;
+      }
+      keys.push_back(key);
+      continue;
+    }
+    offset += length;
+
+    key.key = K_ESC;
+    if (sequence.size() == 1) {
+      key.key = readMoreEscapeSequence(sequence[0], key.sequence);
+    } else if (sequence.size() > 1) {
+      std::map<std::string, KeyEvent> &table = escape_table();
+      auto it = table.find(sequence);
+      if (it != table.end()) {
+        key = it->second;
       }
-
-      return c;
     }
+    keys.push_back(key);
+  }
+
+  buffer.erase(0, offset);
+  offset = 0;
+}
+
+bool InputDecoder::next(KeyEvent &key) {
+  if (keys.size() == 0) {
+    decode();
+  }
+  if (keys.size() == 0) {
+    return false;
+  }
+  key = keys.front();
+  keys.pop_front();
+  return true;
+}
+
+bool InputDecoder::pending() { return keys.size() > 0; }
+
+int readKey(std::string &keySequence) {
+  InputDecoder *input = InputDecoder::instance();
+  if (!input->pending() && kbhit(100) != 0) {
+    input->fill(STDIN_FILENO);
+  }
+  KeyEvent key;
+  if (!input->next(key)) {
+    return -1;
+  }
+  if (key.sequence.size()) {
+    keySequence = key.sequence;
+  }
+  // a paste nobody took is dropped with the next key
+  input->paste.clear();
+  if (key.key == K_PASTE) {
+    input->paste.swap(key.text);
   }
-  return -1;
+  return key.key;
 }
@@ -1,6 +1,7 @@
 #ifndef TE_KEYINPUT_H
 #define TE_KEYINPUT_H
 
+#include <deque>
 #include <string>
 
 #define CTRL_KEY(k) ((k)&0x1f)
@@ -54,7 +55,50 @@ enum KEY_ACTION {
   K_END_KEY,
   K_PAGE_UP,
   K_PAGE_DOWN,
-  K_INSERT
+  K_INSERT,
+  K_PASTE
+};
+
+#define INPUT_BUFFER_SIZE 4096
+#define INPUT_ESCAPE_WAIT 500 // us for the rest of a split escape sequence
+#define INPUT_ESCAPE_MAX 16
+#define INPUT_PASTE_BEGIN "\x1b[200~"
+#define INPUT_PASTE_END "\x1b[201~"
+
+class KeyEvent {
+public:
+  KeyEvent(int key = -1, std::string sequence = "")
+      : key(key), sequence(sequence) {}
+
+  int key;
+  std::string sequence;
+  std::string text; // pasted text
+};
+
+// Turns terminal bytes into keys. Everything available is read with one
+// call and decoded at once, so a burst of typing or key repeat queues up
+// here and is applied before the next render. A bracketed paste becomes a
+// single key holding the whole text.
+class InputDecoder {
+public:
+  InputDecoder();
+
+  static InputDecoder *instance();
+
+  std::string buffer;
+  size_t offset;
+  std::deque<KeyEvent> keys;
+  int escape_wait; // 0 decodes a cut short sequence right away
+  std::string paste; // text of the paste readKey just returned
+
+  size_t fill(int fd);
+  void feed(std::string bytes);
+  size_t scan_escape(size_t start);
+  bool is_paste_prefix(size_t start);
+  bool scan_paste(size_t start, KeyEvent &key);
+  void decode();
+  bool next(KeyEvent &key);
+  bool pending();
 };
 
 int kbhit(int timeout = 500);
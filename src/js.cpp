@@ -108,6 +108,7 @@ void JS::shutdown() {
 
 int JS::run_script(std::string script, std::string path) {
 #if ENABLE_JS
+  ran_scripts = true;
   JSValue ret;
   ret = JS_Eval(ctx, script.c_str(), script.length(), path.c_str(),
                 JS_EVAL_TYPE_GLOBAL);
@@ -129,8 +130,19 @@ int JS::run_file(std::string path) {
   return run_script(buffer.str(), path);
 }
 
+// js_std_loop only returns once no timers or handlers are left, so the
+// only work that can wait between calls is what scripts queued since
 void JS::loop() {
 #if ENABLE_JS
+  ran_scripts = false;
   js_std_loop(ctx);
 #endif
+}
+
+bool JS::has_pending_work() {
+#if ENABLE_JS
+  return ran_scripts || (rt && JS_IsJobPending(rt));
+#else
+  return false;
+#endif
 }
\ No newline at end of file
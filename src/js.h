@@ -21,9 +21,12 @@ public:
     int run_file(std::string path);
 
     void loop();
+    bool has_pending_work();
 
     JSRuntime* rt = 0;
     JSContext* ctx = 0;
+    // scripts ran since the last loop, they may have queued jobs or timers
+    bool ran_scripts = false;
 };
 
 #endif // TE_JS_H
\ No newline at end of file
@@ -73,6 +73,8 @@ std::map<std::string, Command> commands = {
     {"ctrl+k+ctrl+p", Command{"indent", ""}},
     {"ctrl+k+ctrl+o", Command{"unindent", ""}},
     {"ctrl+k+ctrl+j", Command{"toggle_block_fold", ""}},
+    {"ctrl+k+ctrl+f", Command{"fold_all", ""}},
+    {"ctrl+k+ctrl+e", Command{"unfold_all", ""}},
     {"ctrl+/", Command{"toggle_comment", ""}},
     // {"ctrl+`", Command{"toggle_console", ""}},
 
@@ -0,0 +1,98 @@
+#include "loader.h"
+#include "util.h"
+
+#include <chrono>
+#include <core/encoding-conversion.h>
+
+#define LOADER_CHUNK_SIZE (1024 * 1024)
+
+Loader::Loader(std::string p)
+    : path(p), state(State::Loading), offset(0), cancelled(false),
+      throughput(0), started(false) {}
+
+Loader::~Loader() {
+  cancelled = true;
+  if (started) {
+    pthread_join(thread, NULL);
+  }
+}
+
+void Loader::set_ready() {
+  state.store(Loader::State::Ready, std::memory_order_release);
+}
+
+bool Loader::is_ready() {
+  return state.load(std::memory_order_acquire) == Loader::State::Ready;
+}
+
+void Loader::set_consumed() { state = Loader::State::Consumed; }
+
+bool Loader::is_disposable() { return state == Loader::State::Consumed; }
+
+bool Loader::open() { return file.open(path); }
+
+// decode up to length bytes from the current offset, appending to str
+size_t Loader::decode(std::u16string &str, size_t length) {
+  size_t start = offset;
+  if (length > file.size - start) {
+    length = file.size - start;
+  }
+  if (length == 0) {
+    return 0;
+  }
+
+  optional<EncodingConversion> enc = transcoding_from("UTF-8");
+  bool is_last = start + length == file.size;
+  size_t consumed = (*enc).decode(str, file.data + start, length, is_last);
+  hash.update(file.data + start, consumed);
+  offset = start + consumed;
+  return consumed;
+}
+
+bool Loader::take(std::u16string &str) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (pending.size() == 0) {
+    return false;
+  }
+  str = std::move(pending);
+  pending.clear();
+  return true;
+}
+
+int Loader::progress() {
+  if (file.size == 0) {
+    return 100;
+  }
+  return (int)((100 * (size_t)offset) / file.size);
+}
+
+void *loader_thread(void *arg) {
+  Loader *loader = (Loader *)arg;
+  auto start = std::chrono::steady_clock::now();
+  size_t start_offset = loader->offset;
+
+  std::u16string chunk;
+  while (!loader->cancelled && loader->offset < loader->file.size) {
+    chunk.clear();
+    if (loader->decode(chunk, LOADER_CHUNK_SIZE) == 0) {
+      break;
+    }
+    std::lock_guard<std::mutex> lock(loader->mutex);
+    loader->pending += chunk;
+  }
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  double mb = (double)(loader->offset - start_offset) / (1024 * 1024);
+  loader->throughput = elapsed.count() > 0 ? mb / elapsed.count() : 0;
+  log("background load %s %.2fMB %.3fs %.2fMB/s", loader->path.c_str(), mb,
+      elapsed.count(), loader->throughput);
+
+  loader->set_ready();
+  return NULL;
+}
+
+void Loader::run(Loader *loader) {
+  loader->started = true;
+  pthread_create(&loader->thread, NULL, &loader_thread, (void *)(loader));
+}
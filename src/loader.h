@@ -0,0 +1,52 @@
+#ifndef TE_LOADER_H
+#define TE_LOADER_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <string>
+
+#include "files.h"
+
+class Loader {
+public:
+  enum State { Loading, Ready, Consumed, Disposable };
+
+  Loader(std::string p);
+  ~Loader();
+
+  std::string path;
+  // published by the worker once throughput and hash are final
+  std::atomic<State> state;
+  MappedFile file;
+
+  // bytes decoded so far, written by the worker
+  std::atomic<size_t> offset;
+  std::atomic<bool> cancelled;
+  double throughput;
+  // of the bytes decoded so far, complete once the loader is done
+  ContentHash hash;
+
+  pthread_t thread;
+  bool started;
+
+  bool open();
+  size_t decode(std::u16string &str, size_t length);
+  bool take(std::u16string &str);
+  int progress();
+
+  static void run(Loader *loader);
+  void set_ready();
+  bool is_ready();
+  void set_consumed();
+  bool is_disposable();
+
+  // decoded text waiting to be appended to the document by the ui thread
+  std::mutex mutex;
+  std::u16string pending;
+};
+
+typedef std::shared_ptr<Loader> LoaderPtr;
+
+#endif // TE_LOADER_H
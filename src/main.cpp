@@ -18,6 +18,8 @@
 #include "cursor.h"
 #include "document.h"
 #include "editor.h"
+#include "events.h"
+#include "executor.h"
 #include "files.h"
 #include "highlight.h"
 #include "input.h"
@@ -25,6 +27,7 @@
 #include "keybindings.h"
 #include "menu.h"
 #include "render.h"
+#include "scheduler.h"
 #include "theme.h"
 #include "ui.h"
 #include "utf8.h"
@@ -44,6 +47,10 @@ extern int fn;
 extern int kw;
 extern int var;
 
+// while something is still polled: loaders and highlighters
+#define MAIN_POLL_INTERVAL 20
+#define MAIN_REDRAW_TICKS 10
+
 int width = 0;
 int height = 0;
 int last_layout_hash = -1;
@@ -138,12 +145,34 @@ int main(int argc, char **argv) {
       }
       argTheme = argv[i + 1];
     }
+    if (strcmp(argv[i], "-u") == 0) {
+      if (last_arg == i + 1) {
+        last_arg = 0;
+      }
+      // undo history cap per document, in MB
+      UndoJournal::default_limit = (size_t)atoi(argv[i + 1]) * 1024 * 1024;
+    }
+    if (strcmp(argv[i], "-b") == 0) {
+      if (last_arg == i + 1) {
+        last_arg = 0;
+      }
+      // frame budget in ms
+      double budget = atof(argv[i + 1]);
+      if (!(budget >= SCHEDULER_MIN_FRAME_BUDGET)) {
+        budget = SCHEDULER_MIN_FRAME_BUDGET;
+      }
+      Scheduler::instance()->budget = budget;
+    }
   }
 
   if (last_arg != 0) {
     file_path = argv[last_arg];
   }
 
+  // before any thread starts
+  EventLoop events;
+  Executor::instance()->notify_fd = events.wake_fd;
+
   JS js;
   Highlight hl;
 
@@ -246,7 +275,9 @@ int main(int argc, char **argv) {
 
   init_renderer();
 
-  // printf("\x1b[?2004h");
+  // bracketed paste
+  printf("\x1b[?2004h");
+  fflush(stdout);
   update_colors();
 
   _curs_set(0);
@@ -269,6 +300,7 @@ int main(int argc, char **argv) {
     }
 
     // perf_begin_timer("render");
+    Scheduler::instance()->begin_frame();
 
     tabs->show = editors.editors.size() > 1;
 
@@ -301,6 +333,9 @@ int main(int argc, char **argv) {
       last_layout_hash = size;
     }
 
+    // keys still queued from the same read are applied before drawing
+    bool coalesce = did_first_render && InputDecoder::instance()->pending();
+
     // explorer
     draw_menu(explorer, pair_for_color(cmt, false, false),
               explorer->has_focus() ? pair_for_color(fn, false, true)
@@ -308,6 +343,9 @@ int main(int argc, char **argv) {
 
     draw_tabs(tabs, editors);
     for (auto e : editors.editors) {
+      if (coalesce) {
+        break;
+      }
       draw_text_buffer(e, !did_first_render ? height : -1);
       draw_gutter(e, gutter);
     }
@@ -369,9 +407,30 @@ int main(int argc, char **argv) {
 
     Cursor cursor = doc->cursor();
 
+    SaverPtr saver = doc->saver;
+    if (saver && saver->is_ready()) {
+      message.str("");
+      if (saver->success) {
+        message << "saved " << doc->name << " (" << saver->bytes
+                << " bytes)";
+      } else {
+        message << "error saving " << doc->name << ": " << saver->error;
+      }
+      if (saver->history) {
+        doc->history.apply(*saver->history);
+      }
+      saver->set_consumed();
+      doc->saver = nullptr;
+    }
+
     // status
     if (status->show) {
       std::stringstream ss;
+      if (doc->is_loading()) {
+        ss << "loading ";
+        ss << doc->loader->progress();
+        ss << "%   ";
+      }
       if (doc->insert_mode) {
         ss << "INS   ";
       } else {
@@ -464,6 +523,7 @@ int main(int argc, char **argv) {
           doc->clear_cursors();
           doc->cursor().copy_from(Cursor{(*range).start, (*range).end});
           doc->insert_text(value);
+          doc->commit_undo();
         }
         doc->clear_autocomplete(true);
         return true;
@@ -479,9 +539,11 @@ int main(int argc, char **argv) {
     draw_menu(menu);
 
     // blit
-    _move(view_t::input_focus->cursor.y, view_t::input_focus->cursor.x);
-    _refresh();
-    _curs_set(1);
+    if (!coalesce) {
+      _move(view_t::input_focus->cursor.y, view_t::input_focus->cursor.x);
+      _refresh();
+      _curs_set(1);
+    }
 
     if (!did_first_render) {
       perf_end_timer("first render");
@@ -493,27 +555,60 @@ int main(int argc, char **argv) {
     // input
     int ch = -1;
     std::string key_sequence;
-    int frames = 0;
-    int idle = 0;
+    int ticks = 0;
+    Scheduler *scheduler = Scheduler::instance();
+    editor->schedule_idle(false);
     while (running) {
-      ch = readKey(key_sequence);
-      if (ch != -1) {
-        break;
+      if (InputDecoder::instance()->pending()) {
+        ch = readKey(key_sequence);
+        if (ch != -1) {
+          break;
+        }
       }
-      frames++;
 
       // highlight request
       if (editor->request_highlight) {
         break;
       }
 
+      // only poll what cannot wake us up by itself
+      bool busy = warm_start > 0 || hl.has_running_threads() ||
+                  (doc->saver && doc->saver->is_saving());
+      for (auto e : editors.editors) {
+        busy = busy || e->doc->is_loading();
+      }
+#if ENABLE_JS
+      busy = busy || js.has_pending_work();
+#endif
+      events.set_poll_timer(busy ? MAIN_POLL_INTERVAL : -1);
+      events.set_idle_timer(scheduler->next_due());
+
+      int ready = events.wait();
+
+      // hand over finished search, completion and parse results
+      bool delivered = Executor::instance()->deliver() > 0;
+
+      if (ready & EventLoop::Input) {
+        ch = readKey(key_sequence);
+        if (ch != -1) {
+          break;
+        }
+      }
+
 #if ENABLE_JS
-      if (frames % 2 == 0) {
+      if (js.has_pending_work()) {
         js.loop();
       }
 #endif
 
-      // background tasks
+      if (ready & EventLoop::Resize) {
+        get_dimensions(&width, &height);
+        layout(root);
+        editor->doc->make_dirty();
+        break;
+      }
+
+      // background tasks, explorer reads arrive as delivered results
       if (files->update() || !explorer->items.size()) {
         explorer->items.clear();
         FileList &tree = files->tree();
@@ -540,32 +635,38 @@ int main(int argc, char **argv) {
         break;
       }
 
-      if (editor->on_idle(frames)) {
+      if (delivered) {
         break;
       }
 
-      // check dimensions
-      if (frames == 1800 && get_dimensions(&width, &height)) {
-        layout(root);
-        editor->doc->make_dirty();
+      if (doc->saver && doc->saver->is_ready()) {
         break;
       }
 
-      // loop
-      if (frames > 2000) {
-        frames = 0;
-        idle++;
-        if (hl.has_running_threads() || (warm_start-- > 0)) {
-          editor->doc->make_dirty();
-          break;
+      if ((ready & EventLoop::Idle) && scheduler->run()) {
+        break;
+      }
+
+      if (!(ready & EventLoop::Poll)) {
+        continue;
+      }
+
+      // stream in documents still loading
+      bool did_load = false;
+      for (auto e : editors.editors) {
+        if (e->doc->update_loader()) {
+          e->request_treesitter = true;
+          did_load = e->show || did_load;
         }
       }
+      if (did_load) {
+        break;
+      }
 
-      if (idle > 8) {
-        delay(50);
-        if (idle > 32) {
-          delay(250);
-          _curs_set(0);
+      if (++ticks % MAIN_REDRAW_TICKS == 0) {
+        if (hl.has_running_threads() || (warm_start-- > 0)) {
+          editor->doc->make_dirty();
+          break;
         }
       }
     }
@@ -731,6 +832,7 @@ int main(int argc, char **argv) {
         }
         if (search->selected >= 0) {
           editor->doc->insert_text(value);
+          editor->doc->commit_undo();
           search->matches.erase(search->matches.begin() + search->selected);
         }
         if (search->selected >= search->matches.size()) {
@@ -830,6 +932,8 @@ int main(int argc, char **argv) {
     }
   }
 
+  printf("\x1b[?2004l");
+  fflush(stdout);
   shutdown_renderer();
 
   // graceful exit... shutting down...
@@ -839,6 +943,9 @@ int main(int argc, char **argv) {
     delay(50);
   }
 
+  // no job may outlive the documents it reads
+  Executor::instance()->notify_fd = -1;
+  Executor::instance()->shutdown();
   js.shutdown();
   hl.shutdown();
   return 0;
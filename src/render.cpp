@@ -1,4 +1,5 @@
 #include "render.h"
+#include "scheduler.h"
 #include "textmate.h"
 #include "utf8.h"
 #include "util.h"
@@ -11,11 +12,11 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <chrono>
 #include <map>
 
 #define SELECTED_OFFSET 500
 #define HIGHLIGHT_OFFSET 1000
-#define MAX_LINES_HIGHLIGHT_RUN 12
 
 #define RENDER_BACK_PAGES 1
 #define RENDER_AHEAD_PAGES (RENDER_BACK_PAGES + 4)
@@ -653,13 +654,7 @@ void draw_text_line(editor_ptr editor, int screen_row, int row,
   int edge = pair_for_color(fg, true, false);
   *height = 1;
 
-  int fold_size = 0;
-  for (auto f : doc->folds) {
-    if (f.start.row == row) {
-      fold_size = f.end.row - f.start.row;
-      break;
-    }
-  }
+  int fold_size = doc->fold_index().hidden_after(row);
 
   bool is_cursor_row =
       (editor->has_focus() && (row == doc->cursor().start.row || fold_size));
@@ -829,8 +824,9 @@ void draw_text_buffer(editor_ptr editor, int max_highlight_rows) {
   if (!editor->show)
     return;
 
+  Scheduler *scheduler = Scheduler::instance();
   if (max_highlight_rows == -1) {
-    max_highlight_rows = MAX_LINES_HIGHLIGHT_RUN;
+    max_highlight_rows = scheduler->highlight_rows();
   }
 
   DocumentPtr doc = editor->doc;
@@ -854,6 +850,8 @@ void draw_text_buffer(editor_ptr editor, int max_highlight_rows) {
     start = 0;
 
   int dirty_count = 0;
+  int highlighted = 0;
+  std::chrono::steady_clock::duration highlight_time(0);
   editor->request_highlight = false;
 
   bool skip_rendering = false;
@@ -894,11 +892,32 @@ void draw_text_buffer(editor_ptr editor, int max_highlight_rows) {
       if (block->dirty && dirty_count != -1) {
         if (doc->language && !doc->language->definition.isNull()) {
 
+          parse::stack_ptr state = block->parser_state;
+          bool comment_block = block->comment_block;
+          bool string_block = block->string_block;
+
           // log("hl %d", line);
+          std::chrono::steady_clock::time_point begin =
+              std::chrono::steady_clock::now();
           block->styles = Textmate::run_highlighter(
               (char *)s.str().c_str(), doc->language, Textmate::theme(),
               block.get(), doc->previous_block(block).get(),
               doc->next_block(block).get(), NULL);
+          highlight_time += std::chrono::steady_clock::now() - begin;
+          highlighted++;
+
+          // the next line only needs highlighting again if the state it
+          // starts from changed
+          bool changed = !state || !block->parser_state ||
+                         !(*state == *block->parser_state) ||
+                         comment_block != block->comment_block ||
+                         string_block != block->string_block;
+          if (changed) {
+            BlockPtr next = doc->blocks.find(computed_line + 1);
+            if (next) {
+              next->make_dirty();
+            }
+          }
           //&block->span_infos);
 
           // find brackets
@@ -935,6 +954,9 @@ void draw_text_buffer(editor_ptr editor, int max_highlight_rows) {
   }
 
   editor->request_highlight = dirty_count == -1;
+  scheduler->measure_highlight(
+      highlighted,
+      std::chrono::duration<double, std::milli>(highlight_time).count());
 
   for (int i = idx + offset_y; i < editor->computed.h; i++) {
     _move(editor->computed.y + i, editor->computed.x);
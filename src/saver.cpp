@@ -0,0 +1,217 @@
+#include "saver.h"
+#include "files.h"
+#include "utf8.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// utf-16 code units encoded per write
+#define SAVE_CHUNK_SIZE (64 * 1024)
+
+Saver::Saver(std::string p)
+    : path(p), state(State::Loading), snapshot(0), success(false), bytes(0),
+      hash(0), mode(0644), started(false) {}
+
+Saver::~Saver() {
+  if (started) {
+    pthread_join(thread, NULL);
+  }
+  if (snapshot) {
+    delete snapshot;
+  }
+}
+
+void Saver::set_ready() {
+  state.store(Saver::State::Ready, std::memory_order_release);
+}
+
+bool Saver::is_ready() {
+  return state.load(std::memory_order_acquire) == Saver::State::Ready;
+}
+
+bool Saver::is_saving() {
+  return state.load(std::memory_order_acquire) == Saver::State::Loading;
+}
+
+void Saver::set_consumed() { state = Saver::State::Consumed; }
+
+bool Saver::is_disposable() { return state == Saver::State::Consumed; }
+
+static bool write_all(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+static inline bool is_high_surrogate(char16_t c) {
+  return c >= 0xd800 && c <= 0xdbff;
+}
+
+static bool write_snapshot(int fd, TextBuffer::Snapshot *snapshot,
+                           size_t *bytes, uint64_t *hash) {
+  ContentHash content;
+  // worst case is 3 utf-8 bytes per utf-16 code unit
+  std::string out;
+  out.resize(SAVE_CHUNK_SIZE * 3);
+  auto emit = [&](const char16_t *data, size_t length) {
+    size_t n = utf16_to_utf8(data, length, out.data());
+    if (!write_all(fd, out.c_str(), n)) {
+      return false;
+    }
+    content.update(out.c_str(), n);
+    *bytes += n;
+    return true;
+  };
+
+  // a high surrogate ending a slice, waiting for its pair in the next one
+  char16_t pair[2];
+  size_t carried = 0;
+  for (auto slice : snapshot->chunks()) {
+    const char16_t *data = slice.data();
+    size_t size = slice.size();
+    if (carried && size > 0) {
+      pair[1] = data[0];
+      bool joined = pair[1] >= 0xdc00 && pair[1] <= 0xdfff;
+      if (!emit(pair, joined ? 2 : 1)) {
+        return false;
+      }
+      carried = 0;
+      if (joined) {
+        data++;
+        size--;
+      }
+    }
+    while (size > 0) {
+      size_t length = size > SAVE_CHUNK_SIZE ? SAVE_CHUNK_SIZE : size;
+      // never split a surrogate pair across two writes or two slices
+      if (is_high_surrogate(data[length - 1])) {
+        length--;
+        if (length == 0 && size == 1) {
+          pair[0] = data[0];
+          carried = 1;
+          break;
+        }
+      }
+      if (!emit(data, length)) {
+        return false;
+      }
+      data += length;
+      size -= length;
+    }
+  }
+  if (carried && !emit(pair, 1)) {
+    return false;
+  }
+  *hash = content.value();
+  return true;
+}
+
+void *saver_thread(void *arg) {
+  Saver *saver = (Saver *)arg;
+
+  // save through symlinks, replacing the file they point to
+  std::string target = saver->path;
+  char *real = realpath(saver->path.c_str(), NULL);
+  if (real) {
+    target = real;
+    free(real);
+  }
+
+  // write next to the target so that the rename stays on one filesystem
+  std::string tmp_path = target + ".XXXXXX";
+  char *tmp = strdup(tmp_path.c_str());
+  int fd = mkstemp(tmp);
+  tmp_path = tmp;
+  free(tmp);
+
+  if (fd == -1) {
+    saver->error = strerror(errno);
+  } else {
+    // mkstemp creates 0600, give new files the usual 0666 & ~umask
+    struct stat st;
+    if (stat(target.c_str(), &st) == 0) {
+      fchmod(fd, st.st_mode & 07777);
+    } else {
+      fchmod(fd, saver->mode);
+    }
+
+    bool ok = write_snapshot(fd, saver->snapshot, &saver->bytes, &saver->hash) &&
+              fsync(fd) == 0;
+    if (!ok) {
+      saver->error = strerror(errno);
+    }
+    if (close(fd) != 0 && ok) {
+      saver->error = strerror(errno);
+      ok = false;
+    }
+    if (ok && rename(tmp_path.c_str(), target.c_str()) != 0) {
+      saver->error = strerror(errno);
+      ok = false;
+    }
+
+    if (ok) {
+      // make the rename itself durable
+      std::string dir = target;
+      size_t pos = dir.find_last_of('/');
+      dir = pos == std::string::npos ? "." : dir.substr(0, pos + 1);
+      int dfd = open(dir.c_str(), O_RDONLY);
+      if (dfd != -1) {
+        fsync(dfd);
+        close(dfd);
+      }
+    } else {
+      unlink(tmp_path.c_str());
+    }
+    saver->success = ok;
+  }
+
+  // entries go to the side file even if the save failed, the checkpoint
+  // only once the content is on disk
+  if (saver->history) {
+    saver->history->run();
+    if (saver->success) {
+      saver->history->checkpoint(saver->hash);
+    }
+  }
+
+  log("save %s %s %ld bytes", target.c_str(),
+      saver->success ? "ok" : saver->error.c_str(), saver->bytes);
+
+  saver->set_ready();
+  return NULL;
+}
+
+// umask can only be read by setting it, so it is read once from the ui
+// thread before any saver is running
+static mode_t file_mode() {
+  static mode_t mode = 0;
+  static bool read = false;
+  if (!read) {
+    mode_t mask = umask(0);
+    umask(mask);
+    mode = 0666 & ~mask;
+    read = true;
+  }
+  return mode;
+}
+
+void Saver::run(Saver *saver) {
+  saver->mode = file_mode();
+  saver->started = true;
+  pthread_create(&saver->thread, NULL, &saver_thread, (void *)(saver));
+}
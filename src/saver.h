@@ -0,0 +1,49 @@
+#ifndef TE_SAVER_H
+#define TE_SAVER_H
+
+#include <atomic>
+#include <core/text-buffer.h>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <sys/types.h>
+
+#include "history.h"
+
+class Saver {
+public:
+  enum State { Loading, Ready, Consumed, Disposable };
+
+  Saver(std::string p);
+  ~Saver();
+
+  std::string path;
+  // published by the worker once every result field is written
+  std::atomic<State> state;
+  TextBuffer::Snapshot *snapshot;
+
+  bool success;
+  std::string error;
+  size_t bytes;
+  uint64_t hash;
+  // for files that do not exist yet
+  mode_t mode;
+
+  // journal entries written and checkpointed along with the file, handed
+  // back to History::apply once the save is done
+  std::unique_ptr<HistoryWrite> history;
+
+  pthread_t thread;
+  bool started;
+
+  static void run(Saver *saver);
+  void set_ready();
+  bool is_ready();
+  bool is_saving();
+  void set_consumed();
+  bool is_disposable();
+};
+
+typedef std::shared_ptr<Saver> SaverPtr;
+
+#endif // TE_SAVER_H
@@ -0,0 +1,127 @@
+#include "scheduler.h"
+
+// weight of the newest measurement in row_cost
+#define SCHEDULER_SMOOTHING 0.25
+
+static double ms_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+Scheduler::Scheduler()
+    : budget(SCHEDULER_FRAME_BUDGET),
+      frame_start(std::chrono::steady_clock::now()),
+      row_cost((double)SCHEDULER_FRAME_BUDGET / SCHEDULER_HIGHLIGHT_ROWS) {}
+
+Scheduler *Scheduler::instance() {
+  static Scheduler scheduler;
+  return &scheduler;
+}
+
+void Scheduler::schedule(void *owner, std::string name, int delay,
+                         Priority priority, std::function<bool()> run) {
+  std::chrono::steady_clock::time_point due =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(delay);
+  for (auto &t : tasks) {
+    if (t.owner == owner && t.name == name) {
+      t.priority = priority;
+      t.due = due;
+      t.run = run;
+      return;
+    }
+  }
+  tasks.push_back(IdleTask{owner, name, priority, due, run});
+}
+
+bool Scheduler::is_scheduled(void *owner, std::string name) {
+  for (auto &t : tasks) {
+    if (t.owner == owner && t.name == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Scheduler::cancel(void *owner) {
+  for (auto it = tasks.begin(); it != tasks.end();) {
+    if (it->owner == owner) {
+      it = tasks.erase(it);
+    } else {
+      it++;
+    }
+  }
+}
+
+// ms until the next task is due, 0 if one already is, -1 if there is none
+int Scheduler::next_due() {
+  if (tasks.size() == 0) {
+    return -1;
+  }
+  std::chrono::steady_clock::time_point next = tasks[0].due;
+  for (auto &t : tasks) {
+    if (t.due < next) {
+      next = t.due;
+    }
+  }
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if (next <= now) {
+    return 0;
+  }
+  // round up, a timer firing early would find nothing to run
+  return (int)std::chrono::ceil<std::chrono::milliseconds>(next - now).count();
+}
+
+// runs due tasks until the budget is spent, true if any asked for a redraw
+bool Scheduler::run() {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  bool redraw = false;
+  while (ms_since(start) < budget) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    int next = -1;
+    for (int i = 0; i < (int)tasks.size(); i++) {
+      IdleTask &t = tasks[i];
+      if (t.due > now) {
+        continue;
+      }
+      if (next == -1 || t.priority < tasks[next].priority ||
+          (t.priority == tasks[next].priority && t.due < tasks[next].due)) {
+        next = i;
+      }
+    }
+    if (next == -1) {
+      break;
+    }
+    // a task may schedule others while it runs
+    IdleTask task = tasks[next];
+    tasks.erase(tasks.begin() + next);
+    redraw = task.run() || redraw;
+  }
+  return redraw;
+}
+
+void Scheduler::begin_frame() { frame_start = std::chrono::steady_clock::now(); }
+
+double Scheduler::elapsed() { return ms_since(frame_start); }
+
+// rows the rest of this frame's budget can highlight, never so few that a
+// slow frame stops making progress
+int Scheduler::highlight_rows() {
+  double remaining = budget - elapsed();
+  int rows = remaining > 0 ? (int)(remaining / row_cost) : 0;
+  if (rows < SCHEDULER_MIN_HIGHLIGHT_ROWS) {
+    rows = SCHEDULER_MIN_HIGHLIGHT_ROWS;
+  }
+  if (rows > SCHEDULER_MAX_HIGHLIGHT_ROWS) {
+    rows = SCHEDULER_MAX_HIGHLIGHT_ROWS;
+  }
+  return rows;
+}
+
+void Scheduler::measure_highlight(int rows, double ms) {
+  if (rows <= 0) {
+    return;
+  }
+  row_cost = row_cost * (1 - SCHEDULER_SMOOTHING) +
+             (ms / rows) * SCHEDULER_SMOOTHING;
+}
@@ -0,0 +1,56 @@
+#ifndef TE_SCHEDULER_H
+#define TE_SCHEDULER_H
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#define SCHEDULER_FRAME_BUDGET 8 // ms
+#define SCHEDULER_MIN_FRAME_BUDGET 1 // ms, below that nothing would ever run
+#define SCHEDULER_HIGHLIGHT_ROWS 12
+#define SCHEDULER_MIN_HIGHLIGHT_ROWS 4
+#define SCHEDULER_MAX_HIGHLIGHT_ROWS 4096
+
+class IdleTask {
+public:
+  void *owner;
+  std::string name;
+  int priority;
+  std::chrono::steady_clock::time_point due;
+  std::function<bool()> run; // true if the screen needs a redraw
+};
+
+// Deferred work on the ui thread. A task is keyed by its owner and name;
+// scheduling it again pushes its deadline out. Due tasks run most urgent
+// first until the frame budget is spent, whatever is left waits for the
+// next wake up. The same budget paces highlighting: the measured cost per
+// row decides how many dirty rows a frame may highlight.
+class Scheduler {
+public:
+  enum Priority { High, Normal, Low };
+
+  Scheduler();
+
+  static Scheduler *instance();
+
+  double budget; // ms per frame
+  std::vector<IdleTask> tasks;
+
+  std::chrono::steady_clock::time_point frame_start;
+  double row_cost; // ms, smoothed
+
+  void schedule(void *owner, std::string name, int delay, Priority priority,
+                std::function<bool()> run);
+  bool is_scheduled(void *owner, std::string name);
+  void cancel(void *owner);
+  int next_due();
+  bool run();
+
+  void begin_frame();
+  double elapsed();
+  int highlight_rows();
+  void measure_highlight(int rows, double ms);
+};
+
+#endif // TE_SCHEDULER_H
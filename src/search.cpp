@@ -1,15 +1,15 @@
 #include "search.h"
 #include "document.h"
+#include "executor.h"
 #include "util.h"
 
 #include <core/text-buffer.h>
-#include <pthread.h>
 
 #define SEARCH_TTL 32
 
 Search::Search(std::u16string p, Point first_index)
     : key(p), state(State::Loading), snapshot(0), document(0), selected(0),
-      first_index(first_index), ttl(SEARCH_TTL) {}
+      first_index(first_index), ttl(SEARCH_TTL), cancelled(false) {}
 
 Search::~Search() {
   if (snapshot) {
@@ -17,6 +17,21 @@ Search::~Search() {
   }
 }
 
+void Search::cancel() { cancelled = true; }
+
+// the job may still be queued or running and keeps the object alive; the
+// snapshot must go while the document's buffer does, once the job is done
+// with it
+void Search::release() {
+  cancel();
+  std::lock_guard<std::mutex> lock(mutex);
+  if (snapshot) {
+    delete snapshot;
+    snapshot = 0;
+  }
+  document = 0;
+}
+
 void Search::set_ready() { state = Search::State::Ready; }
 
 void Search::set_consumed() { state = Search::State::Consumed; }
@@ -36,14 +51,19 @@ bool Search::is_disposable() {
 void *search_thread(void *arg) {
   log("begin search thread");
   Search *search = (Search *)arg;
-  Document *doc = search->document;
+  std::lock_guard<std::mutex> lock(search->mutex);
   TextBuffer::Snapshot *snapshot = search->snapshot;
 
-  std::u16string error;
-  Regex regex(search->key.c_str(), &error, false, false);
-
-  std::u16string k = search->key;
-  search->matches = snapshot->find_all(regex, Range::all_inclusive());
+  // superseded while queued; a scan already running cannot be interrupted,
+  // its matches are dropped instead
+  if (!search->cancelled && snapshot) {
+    std::u16string error;
+    Regex regex(search->key.c_str(), &error, false, false);
+    search->matches = snapshot->find_all(regex, Range::all_inclusive());
+  }
+  if (search->cancelled) {
+    search->matches.clear();
+  }
 
   int idx = 0;
   for (auto m : search->matches) {
@@ -53,16 +73,19 @@ void *search_thread(void *arg) {
     }
     idx++;
   }
-
-  search->thread_id = 0;
-  search->set_ready();
-
-  delete search->snapshot;
-  search->snapshot = NULL;
   return NULL;
 }
 
-void Search::run(Search *search) {
-  pthread_create((pthread_t *)&(search->thread_id), NULL, &search_thread,
-                 (void *)(search));
+void Search::run(SearchPtr search) {
+  Executor::instance()->submit(
+      [search] {
+        search_thread(search.get());
+        // the snapshot belongs to the ui thread and is dropped there
+        Executor::instance()->publish([search] {
+          delete search->snapshot;
+          search->snapshot = NULL;
+          search->set_ready();
+        });
+      },
+      Executor::Interactive);
 }
\ No newline at end of file
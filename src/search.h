@@ -1,8 +1,10 @@
 #ifndef TE_SEARCH_H
 #define TE_SEARCH_H
 
+#include <atomic>
 #include <core/text-buffer.h>
 #include <memory>
+#include <mutex>
 #include <string>
 
 class Document;
@@ -22,9 +24,14 @@ public:
   int selected;
   Point first_index;
   int ttl;
-  long thread_id;
-
-  static void run(Search *Search);
+  // set when a newer key supersedes this search
+  std::atomic<bool> cancelled;
+  // held by the job while it reads the snapshot
+  std::mutex mutex;
+
+  static void run(std::shared_ptr<Search> search);
+  void cancel();
+  void release();
   void set_ready();
   void set_consumed();
   void keep_alive();
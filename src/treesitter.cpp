@@ -1,11 +1,11 @@
 #include "treesitter.h"
 #include "document.h"
+#include "executor.h"
 #include "utf8.h"
 
 #include <algorithm>
 #include <functional>
 #include <map>
-#include <pthread.h>
 
 extern "C" {
 const TSLanguage *tree_sitter_c(void);
@@ -124,18 +124,18 @@ const char *_read(void *payload, uint32_t byte_index, TSPoint position,
 }
 
 void build_tree(TreeSitter *treesitter) {
-  Document *doc = treesitter->document;
   TextBuffer::Snapshot *snapshot = treesitter->snapshot;
 
-  // log("%x", treesitter->thread_id);
 
   TSTree *old_tree = NULL;
   TSInputEdit edit;
 
 #ifdef ENABLE_INCREMENTAL_UPDATE
   // get changes from last treesitter run
-  if (treesitter->reference) {
-    old_tree = treesitter->reference->tree;
+  if (treesitter->reference && treesitter->reference->tree) {
+    // a base can be handed to a second parse once a newer revision cancels
+    // this one, so edits only ever go to a private copy
+    old_tree = ts_tree_copy(treesitter->reference->tree);
 
     std::vector<TSInputEdit> edits;
 
@@ -146,6 +146,7 @@ void build_tree(TreeSitter *treesitter) {
       // This is dropped if it is a multiline edit
       if (c.old_start.row != c.new_start.row ||
           c.old_end.column < c.new_end.column) {
+        ts_tree_delete(old_tree);
         old_tree = NULL;
         break;
       }
@@ -155,6 +156,7 @@ void build_tree(TreeSitter *treesitter) {
       if (base_row == -1) {
         base_row = c.old_start.row;
       } else if (base_row != c.old_start.row) {
+        ts_tree_delete(old_tree);
         old_tree = NULL;
         break;
       }
@@ -186,10 +188,14 @@ void build_tree(TreeSitter *treesitter) {
 
   treesitter->tree = NULL;
 
-  std::string langId = doc->language ? doc->language->id : "--unknown--";
+  std::string langId =
+      treesitter->lang_id != "" ? treesitter->lang_id : "--unknown--";
 
   if (ts_languages.find(langId) == ts_languages.end()) {
     log("language not available %s\n", langId.c_str());
+    if (old_tree) {
+      ts_tree_delete(old_tree);
+    }
     return;
   }
   std::function<const TSLanguage *()> lang = ts_languages[langId];
@@ -198,8 +204,14 @@ void build_tree(TreeSitter *treesitter) {
 #ifdef PARSER_TIMEOUT
   ts_parser_set_timeout_micros(parser, PARSER_TIMEOUT);
 #endif
+  ts_parser_set_cancellation_flag(parser,
+                                  (const size_t *)&treesitter->cancelled);
   if (!ts_parser_set_language(parser, lang())) {
     log("invalid language\n");
+    ts_parser_delete(parser);
+    if (old_tree) {
+      ts_tree_delete(old_tree);
+    }
     return;
   }
 
@@ -225,10 +237,13 @@ void build_tree(TreeSitter *treesitter) {
     // walk_tree(&cursor, 0, -1, -1, &nodes);
     // ts_tree_cursor_delete(&cursor);
 
-  } else {
+  } else if (!treesitter->cancelled) {
     log(">>error parsing tree");
   }
 
+  if (old_tree) {
+    ts_tree_delete(old_tree);
+  }
   ts_parser_delete(parser);
 }
 
@@ -292,7 +307,7 @@ bool TreeSitter::is_available(std::string lang_id) {
 
 TreeSitter::TreeSitter()
     : state(State::Loading), snapshot(0), document(0), tree(NULL),
-      ttl(TREESITTER_TTL), thread_id(0), reference_ready(false) {}
+      ttl(TREESITTER_TTL), reference_ready(false), cancelled(0) {}
 
 TreeSitter::~TreeSitter() {
   if (snapshot) {
@@ -304,6 +319,21 @@ TreeSitter::~TreeSitter() {
   // log("~treesitter");
 }
 
+void TreeSitter::cancel() { cancelled = 1; }
+
+// the job may still be queued or running and keeps the object alive; the
+// snapshot must go while the document's buffer does, once the job is done
+// with it
+void TreeSitter::release() {
+  cancel();
+  std::lock_guard<std::mutex> lock(mutex);
+  if (snapshot) {
+    delete snapshot;
+    snapshot = 0;
+  }
+  document = 0;
+}
+
 void TreeSitter::set_ready() { state = TreeSitter::State::Ready; }
 
 void TreeSitter::set_consumed() { state = TreeSitter::State::Consumed; }
@@ -344,15 +374,20 @@ void *treeSitter_thread(void *arg) {
   perf_begin_timer("treesitter");
 
   TreeSitter *treesitter = (TreeSitter *)arg;
+  std::lock_guard<std::mutex> lock(treesitter->mutex);
 
   // converting to and parsing with utf8 and is faster that parsing utf16
   // up to some point with very large files conversion is too slow
-  treesitter->content = u16string_to_string(treesitter->snapshot->text());
-
-  build_tree(treesitter);
+  if (!treesitter->cancelled && treesitter->snapshot) {
+    treesitter->content = u16string_to_string(treesitter->snapshot->text());
+  }
+  if (!treesitter->cancelled) {
+    build_tree(treesitter);
+  }
 
-  treesitter->thread_id = 0;
-  treesitter->set_ready();
+  if (treesitter->cancelled) {
+    log("treesitter: parse cancelled");
+  }
 
   // build_reference(treesitter);
   // treesitter->reference_ready = true;
@@ -366,7 +401,19 @@ void *treeSitter_thread(void *arg) {
   return NULL;
 }
 
-void TreeSitter::run(TreeSitter *treesitter) {
-  pthread_create((pthread_t *)&(treesitter->thread_id), NULL,
-                 &treeSitter_thread, (void *)(treesitter));
+void TreeSitter::run(TreeSitterPtr treesitter) {
+  Executor::instance()->submit(
+      [treesitter] {
+        treeSitter_thread(treesitter.get());
+        Executor::instance()->publish([treesitter] {
+          // superseded, nothing will diff against this revision; snapshots
+          // are only ever dropped on the ui thread
+          if (treesitter->cancelled && treesitter->snapshot) {
+            delete treesitter->snapshot;
+            treesitter->snapshot = NULL;
+          }
+          treesitter->set_ready();
+        });
+      },
+      Executor::Visible);
 }
\ No newline at end of file
@@ -1,8 +1,10 @@
 #ifndef TE_SITTER_H
 #define TE_SITTER_H
 
+#include <atomic>
 #include <core/text-buffer.h>
 #include <memory>
+#include <mutex>
 #include <string>
 
 extern "C" {
@@ -24,14 +26,20 @@ public:
   TSTree *tree;
 
   int ttl;
-  long thread_id;
   bool reference_ready;
+  // set when a newer revision supersedes this parse; a size_t so that the
+  // parser can poll it directly
+  std::atomic<size_t> cancelled;
+  // held by the job while it reads the snapshot
+  std::mutex mutex;
 
   std::string lang_id;
   std::vector<std::string> identifiers;
   std::string content;
 
-  static void run(TreeSitter *treesitter);
+  static void run(std::shared_ptr<TreeSitter> treesitter);
+  void cancel();
+  void release();
   void set_ready();
   void set_consumed();
   void keep_alive();
@@ -0,0 +1,339 @@
+#include "undo.h"
+#include "util.h"
+
+#include <string.h>
+
+// line breaks as superstring counts them: \n, \r\n and a lone \r
+Point text_extent(const char16_t *text, size_t length) {
+  Point res{0, 0};
+  for (size_t i = 0; i < length; i++) {
+    if (text[i] == u'\n' ||
+        (text[i] == u'\r' && (i + 1 == length || text[i + 1] != u'\n'))) {
+      res.row++;
+      res.column = 0;
+    } else if (text[i] != u'\r') {
+      res.column++;
+    }
+  }
+  return res;
+}
+
+static bool is_space(char16_t c) { return c == u' ' || c == u'\t'; }
+
+//---------------
+// arena
+//---------------
+
+UndoArena::UndoArena() : first_block(0), start(0), end(0) {}
+
+UndoArena::~UndoArena() { clear(); }
+
+size_t UndoArena::append(const std::u16string &text) {
+  size_t position = end;
+  const char16_t *data = text.data();
+  size_t length = text.size();
+  while (length > 0) {
+    size_t offset = end % UNDO_ARENA_BLOCK_SIZE;
+    if (end / UNDO_ARENA_BLOCK_SIZE >= first_block + blocks.size()) {
+      blocks.push_back(new char16_t[UNDO_ARENA_BLOCK_SIZE]);
+    }
+    size_t n = UNDO_ARENA_BLOCK_SIZE - offset;
+    if (n > length) {
+      n = length;
+    }
+    char16_t *block = blocks[end / UNDO_ARENA_BLOCK_SIZE - first_block];
+    memcpy(block + offset, data, n * sizeof(char16_t));
+    data += n;
+    length -= n;
+    end += n;
+  }
+  return position;
+}
+
+std::u16string UndoArena::read(size_t position, size_t length) {
+  std::u16string res;
+  res.reserve(length);
+  while (length > 0) {
+    size_t offset = position % UNDO_ARENA_BLOCK_SIZE;
+    size_t n = UNDO_ARENA_BLOCK_SIZE - offset;
+    if (n > length) {
+      n = length;
+    }
+    char16_t *block = blocks[position / UNDO_ARENA_BLOCK_SIZE - first_block];
+    res.append(block + offset, n);
+    position += n;
+    length -= n;
+  }
+  return res;
+}
+
+// frees the blocks that lie entirely before position
+void UndoArena::release(size_t position) {
+  if (position > start) {
+    start = position;
+  }
+  while (blocks.size() > 0 &&
+         (first_block + 1) * UNDO_ARENA_BLOCK_SIZE <= position) {
+    delete[] blocks.front();
+    blocks.pop_front();
+    first_block++;
+  }
+}
+
+// drops everything from position on, the most recent appends
+void UndoArena::truncate(size_t position) {
+  end = position;
+  if (start > end) {
+    start = end;
+  }
+  size_t keep = (end + UNDO_ARENA_BLOCK_SIZE - 1) / UNDO_ARENA_BLOCK_SIZE;
+  while (blocks.size() > 0 && first_block + blocks.size() > keep) {
+    delete[] blocks.back();
+    blocks.pop_back();
+  }
+}
+
+void UndoArena::clear() {
+  for (auto b : blocks) {
+    delete[] b;
+  }
+  blocks.clear();
+  // start the next append on a fresh block
+  end = ((end + UNDO_ARENA_BLOCK_SIZE - 1) / UNDO_ARENA_BLOCK_SIZE) *
+        UNDO_ARENA_BLOCK_SIZE;
+  first_block = end / UNDO_ARENA_BLOCK_SIZE;
+  start = end;
+}
+
+size_t UndoArena::memory() { return (end - start) * sizeof(char16_t); }
+
+//---------------
+// journal
+//---------------
+
+size_t UndoJournal::default_limit = UNDO_MEMORY_LIMIT;
+
+UndoJournal::UndoJournal()
+    : limit(default_limit), sealed(0), evicted_entries(0), open(false),
+      reported(0) {}
+
+void UndoJournal::record(Range range, const std::u16string &old_text,
+                         const std::u16string &new_text) {
+  if (!open) {
+    entries.push_back(UndoEntry{0, false, 0});
+    open = true;
+  }
+
+  Point extent = text_extent(new_text.data(), new_text.size());
+  Point end = range.start.traverse(extent);
+
+  deltas.push_back(UndoDelta{Range{range.start, end},
+                             arena.append(old_text), old_text.size()});
+
+  UndoEntry &entry = entries.back();
+  entry.count++;
+  entry.typing = entry.count == 1 && old_text.size() == 0 &&
+                 new_text.size() == 1 && new_text[0] != u'\n';
+  if (entry.typing) {
+    entry.last_character = new_text[0];
+  }
+}
+
+// folds a single typed character into the previous entry when it
+// continues the same run of typing; a run ends after whitespace
+bool UndoJournal::coalesce() {
+  if (entries.size() < 2) {
+    return false;
+  }
+  UndoEntry &entry = entries.back();
+  UndoEntry &prev = entries[entries.size() - 2];
+  if (entries.size() - 2 < sealed) {
+    return false;
+  }
+  if (!entry.typing || !prev.typing) {
+    return false;
+  }
+  if (is_space(prev.last_character) && !is_space(entry.last_character)) {
+    return false;
+  }
+
+  UndoDelta &delta = deltas.back();
+  UndoDelta &prev_delta = deltas[deltas.size() - 2];
+  if (prev_delta.range.end != delta.range.start) {
+    return false;
+  }
+
+  prev_delta.range.end = delta.range.end;
+  prev.last_character = entry.last_character;
+  deltas.pop_back();
+  entries.pop_back();
+  return true;
+}
+
+// drops the oldest entries until the journal fits its limit, always
+// keeping the newest one so that the last edit can be undone; redo entries
+// go from the end replayed last. While undoing, redo entries go first so
+// that the entries still to be undone are kept.
+void UndoJournal::evict(bool undoing) {
+  size_t evicted = 0;
+  while (memory() > limit) {
+    bool redo = redo_entries.size() > 1 &&
+                (undoing || entries.size() <= 1);
+    if (redo) {
+      for (size_t i = 0; i < redo_entries.front(); i++) {
+        redo_deltas.pop_front();
+      }
+      redo_entries.pop_front();
+      if (redo_deltas.size() > 0) {
+        redo_arena.release(redo_deltas.front().text);
+      }
+    } else if (entries.size() > 1) {
+      UndoEntry &entry = entries.front();
+      for (size_t i = 0; i < entry.count; i++) {
+        deltas.pop_front();
+      }
+      entries.pop_front();
+      evicted_entries++;
+      if (sealed > 0) {
+        sealed--;
+      }
+      if (deltas.size() > 0) {
+        arena.release(deltas.front().text);
+      }
+    } else {
+      break;
+    }
+    evicted++;
+  }
+  if (evicted > 0) {
+    log("undo: evicted %d entries, %d bytes in use", (int)evicted,
+        (int)memory());
+    reported = memory();
+  }
+}
+
+// logs memory use each time it moves by a step
+void UndoJournal::report() {
+  size_t bytes = memory();
+  if (bytes >= reported + UNDO_REPORT_STEP ||
+      bytes + UNDO_REPORT_STEP <= reported) {
+    log("undo: %ldKB in use, %ld entries, %ld redo", bytes / 1024,
+        entries.size(), redo_entries.size());
+    reported = bytes;
+  }
+}
+
+void UndoJournal::commit() {
+  if (!open) {
+    return;
+  }
+  open = false;
+  if (!coalesce()) {
+    evict();
+  }
+  report();
+}
+
+bool UndoJournal::pop(std::vector<UndoChange> &changes) {
+  commit();
+  if (entries.size() == 0) {
+    return false;
+  }
+
+  UndoEntry entry = entries.back();
+  entries.pop_back();
+  if (sealed > entries.size()) {
+    sealed = entries.size();
+  }
+
+  // newest first, each in the coordinates right after its own edit
+  for (size_t i = 0; i < entry.count; i++) {
+    UndoDelta &delta = deltas.back();
+    changes.push_back(
+        UndoChange{delta.range, arena.read(delta.text, delta.length)});
+    arena.truncate(delta.text);
+    deltas.pop_back();
+  }
+  return true;
+}
+
+void UndoJournal::clear() {
+  deltas.clear();
+  entries.clear();
+  arena.clear();
+  clear_redo();
+  sealed = 0;
+  evicted_entries = 0;
+  open = false;
+}
+
+void UndoJournal::push_redo(const std::vector<UndoChange> &changes) {
+  for (auto &c : changes) {
+    redo_deltas.push_back(UndoDelta{c.range, redo_arena.append(c.old_text),
+                                    c.old_text.size()});
+  }
+  redo_entries.push_back(changes.size());
+  evict(true);
+  report();
+}
+
+bool UndoJournal::pop_redo(std::vector<UndoChange> &changes) {
+  if (redo_entries.size() == 0) {
+    return false;
+  }
+  size_t count = redo_entries.back();
+  redo_entries.pop_back();
+  for (size_t i = 0; i < count; i++) {
+    UndoDelta &delta = redo_deltas.back();
+    changes.push_back(
+        UndoChange{delta.range, redo_arena.read(delta.text, delta.length)});
+    redo_arena.truncate(delta.text);
+    redo_deltas.pop_back();
+  }
+  return true;
+}
+
+void UndoJournal::clear_redo() {
+  if (redo_entries.size() == 0) {
+    return;
+  }
+  redo_deltas.clear();
+  redo_entries.clear();
+  redo_arena.clear();
+}
+
+void UndoJournal::seal() {
+  commit();
+  sealed = entries.size();
+}
+
+// the deltas of entries from index on, oldest entry and delta first
+void UndoJournal::export_entries(
+    size_t from, std::vector<std::vector<UndoChange>> &changes) {
+  size_t delta = 0;
+  for (size_t i = 0; i < entries.size(); i++) {
+    size_t count = entries[i].count;
+    if (i >= from) {
+      std::vector<UndoChange> entry;
+      for (size_t j = delta; j < delta + count; j++) {
+        entry.push_back(UndoChange{deltas[j].range,
+                                   arena.read(deltas[j].text, deltas[j].length)});
+      }
+      changes.push_back(entry);
+    }
+    delta += count;
+  }
+}
+
+bool UndoJournal::is_empty() { return entries.size() == 0; }
+
+size_t UndoJournal::size() { return entries.size(); }
+
+size_t UndoJournal::evicted() { return evicted_entries; }
+
+size_t UndoJournal::memory() {
+  return arena.memory() + deltas.size() * sizeof(UndoDelta) +
+         entries.size() * sizeof(UndoEntry) + redo_arena.memory() +
+         redo_deltas.size() * sizeof(UndoDelta) +
+         redo_entries.size() * sizeof(size_t);
+}
@@ -0,0 +1,112 @@
+#ifndef TE_UNDO_H
+#define TE_UNDO_H
+
+#include <core/text-buffer.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#define UNDO_ARENA_BLOCK_SIZE (64 * 1024)    // utf-16 code units
+#define UNDO_MEMORY_LIMIT (64 * 1024 * 1024) // bytes
+#define UNDO_REPORT_STEP (1024 * 1024)       // bytes between memory logs
+
+Point text_extent(const char16_t *text, size_t length);
+
+// Append-only text storage released from the front. Positions are
+// absolute and never reused, so released text is simply out of range.
+class UndoArena {
+public:
+  UndoArena();
+  ~UndoArena();
+
+  size_t append(const std::u16string &text);
+  std::u16string read(size_t position, size_t length);
+  void release(size_t position);
+  void truncate(size_t position);
+  void clear();
+  // bytes of text still in range; at most a block more is allocated
+  size_t memory();
+
+private:
+  std::deque<char16_t *> blocks;
+  size_t first_block;
+  size_t start;
+  size_t end;
+};
+
+// One edit: range is where the new text sits right after the edit, the
+// text it replaced is kept in the arena. The new text itself is not kept;
+// it is read back from the buffer if the edit is ever undone.
+class UndoDelta {
+public:
+  Range range;
+  size_t text;
+  size_t length;
+};
+
+class UndoEntry {
+public:
+  size_t count;
+  bool typing;
+  char16_t last_character;
+};
+
+// A range and the text to put in its place, as handed back by the journal:
+// on undo the text the edit replaced, on redo the text the edit had put
+// there
+class UndoChange {
+public:
+  Range range;
+  std::u16string old_text;
+};
+
+class UndoJournal {
+public:
+  UndoJournal();
+
+  static size_t default_limit;
+  size_t limit;
+
+  void record(Range range, const std::u16string &old_text,
+              const std::u16string &new_text);
+  void commit();
+  bool pop(std::vector<UndoChange> &changes);
+  void clear();
+
+  // the changes of an undone entry, newest first as pop() returned them;
+  // pop_redo() hands them back oldest first, ready to be replayed
+  void push_redo(const std::vector<UndoChange> &changes);
+  bool pop_redo(std::vector<UndoChange> &changes);
+  void clear_redo();
+
+  // entries before the current end are never extended by coalescing
+  void seal();
+  void export_entries(size_t from,
+                      std::vector<std::vector<UndoChange>> &changes);
+
+  bool is_empty();
+  size_t size();
+  size_t evicted();
+  size_t memory();
+
+private:
+  UndoArena arena;
+  std::deque<UndoDelta> deltas;
+  std::deque<UndoEntry> entries;
+  size_t sealed;
+  size_t evicted_entries;
+  bool open;
+  // undone entries, counted against the same limit; a delta's range is
+  // where the undo left the text the edit had replaced
+  UndoArena redo_arena;
+  std::deque<UndoDelta> redo_deltas;
+  std::deque<size_t> redo_entries;
+  // memory() when last logged
+  size_t reported;
+
+  bool coalesce();
+  void evict(bool undoing = false);
+  void report();
+};
+
+#endif // TE_UNDO_H
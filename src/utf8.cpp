@@ -1,5 +1,11 @@
 #include "utf8.h"
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define REPLACEMENT_CHARACTER 0xfffd
+
 const char *utf8_to_codepoint(const char *p, unsigned *dst) {
   unsigned res, n;
   switch (*p & 0xf0) {
@@ -65,24 +71,308 @@ int codepoint_to_utf8(uint32_t utf, char *out) {
   }
 }
 
-std::string u16string_to_string(std::u16string text) {
-  std::string res;
-  for (auto c : text) {
-    char tmp[5];
-    codepoint_to_utf8(c, (char *)tmp);
-    res += tmp;
+static inline bool is_high_surrogate(char16_t c) {
+  return c >= 0xd800 && c <= 0xdbff;
+}
+
+static inline bool is_low_surrogate(char16_t c) {
+  return c >= 0xdc00 && c <= 0xdfff;
+}
+
+//---------------
+// ascii blocks
+// each kernel looks at one fixed-size block; when every code unit in it is
+// ascii it is copied to dst in one go and true is returned, otherwise the
+// caller falls back to decoding that block one character at a time
+//---------------
+
+#if defined(__AVX2__)
+
+#define UTF16_BLOCK 16
+#define UTF8_BLOCK 32
+
+static inline bool is_ascii_block16(const char16_t *src) {
+  __m256i v = _mm256_loadu_si256((const __m256i *)src);
+  return _mm256_testz_si256(v, _mm256_set1_epi16((short)0xff80));
+}
+
+static inline bool narrow_ascii_block(const char16_t *src, char *dst) {
+  __m256i v = _mm256_loadu_si256((const __m256i *)src);
+  if (!_mm256_testz_si256(v, _mm256_set1_epi16((short)0xff80))) {
+    return false;
+  }
+  // packus works per 128 bit lane, gather the two low quads together
+  __m256i packed = _mm256_packus_epi16(v, v);
+  packed = _mm256_permute4x64_epi64(packed, 0x08);
+  _mm_storeu_si128((__m128i *)dst, _mm256_castsi256_si128(packed));
+  return true;
+}
+
+static inline bool widen_ascii_block(const char *src, char16_t *dst) {
+  __m256i v = _mm256_loadu_si256((const __m256i *)src);
+  if (_mm256_movemask_epi8(v) != 0) {
+    return false;
+  }
+  __m128i lo = _mm256_castsi256_si128(v);
+  __m128i hi = _mm256_extracti128_si256(v, 1);
+  _mm256_storeu_si256((__m256i *)dst, _mm256_cvtepu8_epi16(lo));
+  _mm256_storeu_si256((__m256i *)(dst + 16), _mm256_cvtepu8_epi16(hi));
+  return true;
+}
+
+#elif defined(__SSE2__)
+
+#define UTF16_BLOCK 8
+#define UTF8_BLOCK 16
+
+static inline bool is_ascii_block16(const char16_t *src) {
+  __m128i v = _mm_loadu_si128((const __m128i *)src);
+  __m128i hi = _mm_and_si128(v, _mm_set1_epi16((short)0xff80));
+  return _mm_movemask_epi8(_mm_cmpeq_epi16(hi, _mm_setzero_si128())) ==
+         0xffff;
+}
+
+static inline bool narrow_ascii_block(const char16_t *src, char *dst) {
+  __m128i v = _mm_loadu_si128((const __m128i *)src);
+  __m128i hi = _mm_and_si128(v, _mm_set1_epi16((short)0xff80));
+  if (_mm_movemask_epi8(_mm_cmpeq_epi16(hi, _mm_setzero_si128())) !=
+      0xffff) {
+    return false;
+  }
+  _mm_storel_epi64((__m128i *)dst, _mm_packus_epi16(v, v));
+  return true;
+}
+
+static inline bool widen_ascii_block(const char *src, char16_t *dst) {
+  __m128i v = _mm_loadu_si128((const __m128i *)src);
+  if (_mm_movemask_epi8(v) != 0) {
+    return false;
+  }
+  __m128i zero = _mm_setzero_si128();
+  _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(v, zero));
+  _mm_storeu_si128((__m128i *)(dst + 8), _mm_unpackhi_epi8(v, zero));
+  return true;
+}
+
+#else
+
+#define UTF16_BLOCK 8
+#define UTF8_BLOCK 8
+
+static inline bool is_ascii_block16(const char16_t *src) {
+  char16_t bits = 0;
+  for (int i = 0; i < UTF16_BLOCK; i++) {
+    bits |= src[i];
+  }
+  return bits < 0x80;
+}
+
+static inline bool narrow_ascii_block(const char16_t *src, char *dst) {
+  if (!is_ascii_block16(src)) {
+    return false;
+  }
+  for (int i = 0; i < UTF16_BLOCK; i++) {
+    dst[i] = (char)src[i];
+  }
+  return true;
+}
+
+static inline bool widen_ascii_block(const char *src, char16_t *dst) {
+  unsigned char bits = 0;
+  for (int i = 0; i < UTF8_BLOCK; i++) {
+    bits |= (unsigned char)src[i];
+  }
+  if (bits & 0x80) {
+    return false;
+  }
+  for (int i = 0; i < UTF8_BLOCK; i++) {
+    dst[i] = (char16_t)src[i];
+  }
+  return true;
+}
+
+#endif
+
+//---------------
+// transcoders
+//---------------
+
+size_t utf8_length(const char16_t *src, size_t length) {
+  size_t res = 0;
+  size_t i = 0;
+  while (i < length) {
+    size_t end = length;
+    if (i + UTF16_BLOCK <= length) {
+      if (is_ascii_block16(src + i)) {
+        res += UTF16_BLOCK;
+        i += UTF16_BLOCK;
+        continue;
+      }
+      end = i + UTF16_BLOCK;
+    }
+    // a surrogate pair may run one unit past the end of the block
+    while (i < end) {
+      char16_t c = src[i++];
+      if (c < 0x80) {
+        res += 1;
+      } else if (c < 0x800) {
+        res += 2;
+      } else if (is_high_surrogate(c) && i < length &&
+                 is_low_surrogate(src[i])) {
+        res += 4;
+        i++;
+      } else {
+        // lone surrogates become U+FFFD, also 3 bytes
+        res += 3;
+      }
+    }
   }
   return res;
 }
 
-std::u16string string_to_u16string(std::string text) {
-  std::u16string res;
-  char *p = (char *)text.c_str();
-  while (*p) {
-    unsigned cp;
-    p = (char *)utf8_to_codepoint(p, &cp);
-    res += (wchar_t)cp;
+size_t utf16_to_utf8(const char16_t *src, size_t length, char *dst) {
+  char *out = dst;
+  size_t i = 0;
+  while (i < length) {
+    size_t end = length;
+    if (i + UTF16_BLOCK <= length) {
+      if (narrow_ascii_block(src + i, out)) {
+        out += UTF16_BLOCK;
+        i += UTF16_BLOCK;
+        continue;
+      }
+      end = i + UTF16_BLOCK;
+    }
+    while (i < end) {
+      uint32_t cp = src[i++];
+      if (cp < 0x80) {
+        *out++ = (char)cp;
+        continue;
+      }
+      if (is_high_surrogate(cp) && i < length && is_low_surrogate(src[i])) {
+        cp = 0x10000 + ((cp - 0xd800) << 10) + (src[i++] - 0xdc00);
+      } else if (is_high_surrogate(cp) || is_low_surrogate(cp)) {
+        cp = REPLACEMENT_CHARACTER;
+      }
+      if (cp < 0x800) {
+        out[0] = (char)(0xc0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3f));
+        out += 2;
+      } else if (cp < 0x10000) {
+        out[0] = (char)(0xe0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+        out[2] = (char)(0x80 | (cp & 0x3f));
+        out += 3;
+      } else {
+        out[0] = (char)(0xf0 | (cp >> 18));
+        out[1] = (char)(0x80 | ((cp >> 12) & 0x3f));
+        out[2] = (char)(0x80 | ((cp >> 6) & 0x3f));
+        out[3] = (char)(0x80 | (cp & 0x3f));
+        out += 4;
+      }
+    }
+  }
+  return out - dst;
+}
+
+// malformed input decodes to U+FFFD, one per maximal subpart of an
+// ill-formed sequence (the Unicode recommended practice)
+size_t utf8_to_utf16(const char *src, size_t length, char16_t *dst) {
+  const unsigned char *s = (const unsigned char *)src;
+  char16_t *out = dst;
+  size_t i = 0;
+  while (i < length) {
+    size_t end = length;
+    if (i + UTF8_BLOCK <= length) {
+      if (widen_ascii_block(src + i, out)) {
+        out += UTF8_BLOCK;
+        i += UTF8_BLOCK;
+        continue;
+      }
+      end = i + UTF8_BLOCK;
+    }
+    // a multi-byte sequence may run past the end of the block
+    while (i < end) {
+      unsigned char c = s[i];
+      if (c < 0x80) {
+        *out++ = c;
+        i++;
+        continue;
+      }
+
+      // the second byte range also rules out overlongs, surrogates and
+      // code points past U+10FFFF
+      uint32_t cp;
+      size_t n;
+      unsigned char lo = 0x80;
+      unsigned char hi = 0xbf;
+      if (c >= 0xc2 && c <= 0xdf) {
+        cp = c & 0x1f;
+        n = 1;
+      } else if (c >= 0xe0 && c <= 0xef) {
+        cp = c & 0x0f;
+        n = 2;
+        if (c == 0xe0) {
+          lo = 0xa0;
+        } else if (c == 0xed) {
+          hi = 0x9f;
+        }
+      } else if (c >= 0xf0 && c <= 0xf4) {
+        cp = c & 0x07;
+        n = 3;
+        if (c == 0xf0) {
+          lo = 0x90;
+        } else if (c == 0xf4) {
+          hi = 0x8f;
+        }
+      } else {
+        *out++ = REPLACEMENT_CHARACTER;
+        i++;
+        continue;
+      }
+
+      size_t j = 1;
+      for (; j <= n && i + j < length; j++) {
+        unsigned char b = s[i + j];
+        if (b < lo || b > hi) {
+          break;
+        }
+        cp = (cp << 6) | (b & 0x3f);
+        lo = 0x80;
+        hi = 0xbf;
+      }
+
+      if (j <= n) {
+        // the lead and the continuation bytes that were valid so far
+        *out++ = REPLACEMENT_CHARACTER;
+        i += j;
+        continue;
+      }
+
+      if (cp >= 0x10000) {
+        cp -= 0x10000;
+        *out++ = (char16_t)(0xd800 + (cp >> 10));
+        *out++ = (char16_t)(0xdc00 + (cp & 0x3ff));
+      } else {
+        *out++ = (char16_t)cp;
+      }
+      i += n + 1;
+    }
   }
+  return out - dst;
+}
 
+std::string u16string_to_string(const std::u16string &text) {
+  std::string res;
+  res.resize(utf8_length(text.data(), text.size()));
+  utf16_to_utf8(text.data(), text.size(), res.data());
+  return res;
+}
+
+std::u16string string_to_u16string(const std::string &text) {
+  // never more utf-16 code units than utf-8 bytes
+  std::u16string res;
+  res.resize(text.size());
+  res.resize(utf8_to_utf16(text.data(), text.size(), res.data()));
   return res;
 }
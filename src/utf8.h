@@ -1,11 +1,19 @@
 #ifndef TE_UTF8_H
 #define TE_UTF8_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
 const char *utf8_to_codepoint(const char *p, unsigned *dst);
 int codepoint_to_utf8(uint32_t utf, char *out);
-std::string u16string_to_string(std::u16string text);
-std::u16string string_to_u16string(std::string text);
+
+// raw transcoders; dst must have room for utf8_length()/length code units
+size_t utf8_length(const char16_t *src, size_t length);
+size_t utf16_to_utf8(const char16_t *src, size_t length, char *dst);
+size_t utf8_to_utf16(const char *src, size_t length, char16_t *dst);
+
+std::string u16string_to_string(const std::u16string &text);
+std::u16string string_to_u16string(const std::string &text);
 
 #endif // TE_UTF8_H
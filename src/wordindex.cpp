@@ -0,0 +1,323 @@
+#include "wordindex.h"
+#include "executor.h"
+#include "util.h"
+#include "words.h"
+
+#include <mutex>
+
+// ui thread only, the builder tokenizes with its own scratch; with shared
+// set, words entering or leaving counts are forwarded to the shared index
+static void count_words(WordCounts &counts, const std::u16string &line,
+                        int delta, CompletionIndex *shared) {
+  static std::vector<Range> words;
+  words.clear();
+  tokenize_words(line.data(), line.size(), 0, words);
+  for (auto &w : words) {
+    std::u16string word =
+        line.substr(w.start.column, w.end.column - w.start.column);
+    int &count = counts[word];
+    bool added = count == 0;
+    count += delta;
+    if (!shared) {
+      continue;
+    }
+    if (count <= 0) {
+      counts.erase(word);
+      if (!added) {
+        shared->remove(word);
+      }
+    } else if (added) {
+      shared->add(word);
+    }
+  }
+}
+
+// hash node, key and string storage
+static size_t word_memory(const std::u16string &word) {
+  return sizeof(WordCounts::value_type) + 2 * sizeof(void *) +
+         (word.capacity() + 1) * sizeof(char16_t);
+}
+
+//---------------
+// builder
+//---------------
+
+WordIndexBuilder::WordIndexBuilder()
+    : state(State::Loading), snapshot(0), cancelled(false) {}
+
+// the job may still be queued and hold the builder; the snapshot belongs to
+// the ui thread and is dropped there once the job is done with it
+void WordIndexBuilder::release() {
+  cancelled = true;
+  std::lock_guard<std::mutex> lock(mutex);
+  if (snapshot) {
+    delete snapshot;
+    snapshot = 0;
+  }
+}
+
+void WordIndexBuilder::set_ready() { state = WordIndexBuilder::State::Ready; }
+
+void WordIndexBuilder::set_consumed() {
+  state = WordIndexBuilder::State::Consumed;
+}
+
+bool WordIndexBuilder::is_disposable() {
+  return state == WordIndexBuilder::State::Consumed;
+}
+
+static void word_index_job(WordIndexBuilder *builder) {
+  std::lock_guard<std::mutex> lock(builder->mutex);
+  if (builder->cancelled) {
+    return;
+  }
+  TextBuffer::Snapshot *snapshot = builder->snapshot;
+
+  std::vector<Range> words;
+  uint32_t rows = snapshot->extent().row + 1;
+  for (uint32_t row = 0; row < rows && !builder->cancelled; row++) {
+    std::u16string line = snapshot->line_for_row(row);
+    words.clear();
+    tokenize_words(line.data(), line.size(), row, words);
+    for (auto &w : words) {
+      builder->counts[line.substr(w.start.column,
+                                  w.end.column - w.start.column)]++;
+    }
+  }
+
+  log("word index %d rows %ld words", rows, builder->counts.size());
+}
+
+void WordIndexBuilder::run(WordIndexBuilderPtr builder) {
+  Executor::instance()->submit(
+      [builder] {
+        word_index_job(builder.get());
+        Executor::instance()->publish([builder] { builder->set_ready(); });
+      },
+      Executor::Background);
+}
+
+//---------------
+// index
+//---------------
+
+WordIndex::WordIndex() : state(State::Empty) {}
+
+WordIndex::~WordIndex() { clear(); }
+
+void WordIndex::build(TextBuffer &buffer) {
+  clear();
+  buffer.flush_changes();
+  builder = std::make_shared<WordIndexBuilder>();
+  builder->snapshot = buffer.create_snapshot();
+  state = State::Building;
+  WordIndexBuilder::run(builder);
+}
+
+// adopts a finished build, replaying the edits made in the meantime
+bool WordIndex::update() {
+  if (state != State::Building ||
+      builder->state != WordIndexBuilder::State::Ready) {
+    return state == State::Ready;
+  }
+
+  builder->release();
+  counts.swap(builder->counts);
+  for (auto &p : pending) {
+    int &count = counts[p.first];
+    count += p.second;
+    if (count <= 0) {
+      counts.erase(p.first);
+    }
+  }
+  pending.clear();
+  builder->set_consumed();
+  builder = nullptr;
+  state = State::Ready;
+  CompletionIndex::instance()->add_document(counts);
+  return true;
+}
+
+void WordIndex::clear() {
+  if (state == State::Ready) {
+    CompletionIndex::instance()->remove_document(counts);
+  }
+  if (builder) {
+    builder->release();
+    builder = nullptr;
+  }
+  counts.clear();
+  pending.clear();
+  state = State::Empty;
+}
+
+bool WordIndex::is_ready() { return state == State::Ready; }
+
+void WordIndex::add_line(const std::u16string &line, int delta) {
+  if (state == State::Building) {
+    count_words(pending, line, delta, NULL);
+  } else if (state == State::Ready) {
+    count_words(counts, line, delta, CompletionIndex::instance());
+  }
+}
+
+//---------------
+// completion index
+//---------------
+
+// entries kept in the log of added words
+#define COMPLETION_LOG_SIZE 4096
+
+CompletionIndex::CompletionIndex() : generation(0), bytes(0), log_start(0) {}
+
+CompletionIndex *CompletionIndex::instance() {
+  static CompletionIndex index;
+  return &index;
+}
+
+// with the lock held, one entry per generation
+void CompletionIndex::log_added(const std::u16string &word) {
+  added.push_back(word);
+  if (added.size() > COMPLETION_LOG_SIZE) {
+    added.pop_front();
+    log_start++;
+  }
+}
+
+void CompletionIndex::restart_log() {
+  added.clear();
+  log_start = generation;
+}
+
+void CompletionIndex::add(const std::u16string &word) {
+  std::unique_lock<std::shared_mutex> lock(mutex);
+  if (documents[word]++ == 0) {
+    bytes += word_memory(word);
+    generation++;
+    log_added(word);
+  }
+}
+
+void CompletionIndex::remove(const std::u16string &word) {
+  std::unique_lock<std::shared_mutex> lock(mutex);
+  auto it = documents.find(word);
+  if (it == documents.end()) {
+    return;
+  }
+  if (--it->second <= 0) {
+    bytes -= word_memory(word);
+    documents.erase(it);
+    generation++;
+    // a removed word is dropped by refine() as it is no longer indexed
+    log_added(u"");
+  }
+}
+
+void CompletionIndex::add_document(const WordCounts &words) {
+  std::unique_lock<std::shared_mutex> lock(mutex);
+  for (auto &w : words) {
+    if (documents[w.first]++ == 0) {
+      bytes += word_memory(w.first);
+    }
+  }
+  generation++;
+  restart_log();
+  log("completion index +%ld words, %ld words %ldKB", words.size(),
+      documents.size(), bytes / 1024);
+}
+
+void CompletionIndex::remove_document(const WordCounts &words) {
+  std::unique_lock<std::shared_mutex> lock(mutex);
+  for (auto &w : words) {
+    auto it = documents.find(w.first);
+    if (it != documents.end() && --it->second <= 0) {
+      bytes -= word_memory(w.first);
+      documents.erase(it);
+    }
+  }
+  generation++;
+  restart_log();
+  log("completion index -%ld words, %ld words %ldKB", words.size(),
+      documents.size(), bytes / 1024);
+}
+
+size_t CompletionIndex::size() {
+  std::shared_lock<std::shared_mutex> lock(mutex);
+  return documents.size();
+}
+
+size_t CompletionIndex::memory() { return bytes; }
+
+// words visited between checks for cancellation
+#define COMPLETION_CANCEL_STRIDE 1024
+
+// every word matching prefix, unordered; empty once cancelled
+std::vector<FuzzyMatch>
+CompletionIndex::query(const std::u16string &prefix,
+                       const std::atomic<bool> *cancelled) {
+  std::shared_lock<std::shared_mutex> lock(mutex);
+  FuzzyQuery q(prefix);
+  std::vector<FuzzyMatch> res;
+  size_t visited = 0;
+  for (auto &w : documents) {
+    if (cancelled && ++visited % COMPLETION_CANCEL_STRIDE == 0 &&
+        *cancelled) {
+      return {};
+    }
+    if (w.first == prefix) {
+      continue;
+    }
+    int score = q.score(w.first);
+    if (score >= 0) {
+      res.push_back(FuzzyMatch{w.first, score});
+    }
+  }
+  return res;
+}
+
+// the matches of a longer prefix are a subset of those of any shorter one,
+// so the candidates of a cached ancestor prefix computed at generation
+// since only need to be re-scored, dropping words no longer indexed and
+// adding those that appeared after it; false if the log no longer reaches
+// back that far and a full query is needed
+bool CompletionIndex::refine(const std::u16string &prefix,
+                             const std::vector<FuzzyMatch> &candidates,
+                             unsigned since, std::vector<FuzzyMatch> &res,
+                             const std::atomic<bool> *cancelled) {
+  std::shared_lock<std::shared_mutex> lock(mutex);
+  if (since < log_start || since > generation) {
+    return false;
+  }
+  std::unordered_set<std::u16string> appeared;
+  for (size_t i = since - log_start; i < added.size(); i++) {
+    if (added[i].size()) {
+      appeared.insert(added[i]);
+    }
+  }
+
+  FuzzyQuery q(prefix);
+  size_t visited = 0;
+  auto consider = [&](const std::u16string &word) {
+    if (word == prefix || documents.find(word) == documents.end()) {
+      return;
+    }
+    int score = q.score(word);
+    if (score >= 0) {
+      res.push_back(FuzzyMatch{word, score});
+    }
+  };
+  for (auto &c : candidates) {
+    if (cancelled && ++visited % COMPLETION_CANCEL_STRIDE == 0 &&
+        *cancelled) {
+      res.clear();
+      return true;
+    }
+    if (appeared.find(c.text) == appeared.end()) {
+      consider(c.text);
+    }
+  }
+  for (auto &w : appeared) {
+    consider(w);
+  }
+  return true;
+}
@@ -0,0 +1,109 @@
+#ifndef TE_WORDINDEX_H
+#define TE_WORDINDEX_H
+
+#include <atomic>
+#include <core/text-buffer.h>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "fuzzy.h"
+
+typedef std::unordered_map<std::u16string, int> WordCounts;
+
+// counts the words of a snapshot off the ui thread
+class WordIndexBuilder {
+public:
+  enum State { Loading, Ready, Consumed, Disposable };
+
+  WordIndexBuilder();
+
+  State state;
+  TextBuffer::Snapshot *snapshot;
+  WordCounts counts;
+  std::atomic<bool> cancelled;
+  // held by the job while it reads the snapshot
+  std::mutex mutex;
+
+  void release();
+  void set_ready();
+  void set_consumed();
+  bool is_disposable();
+
+  static void run(std::shared_ptr<WordIndexBuilder> builder);
+};
+
+typedef std::shared_ptr<WordIndexBuilder> WordIndexBuilderPtr;
+
+// Occurrence counts of every identifier in a document. Edits remove the
+// words of the rows they replace and add those of the rows they produce.
+// Words entering or leaving the document are forwarded to the shared
+// CompletionIndex.
+class WordIndex {
+public:
+  enum State { Empty, Building, Ready };
+
+  WordIndex();
+  ~WordIndex();
+
+  State state;
+  WordCounts counts;
+  // edits made while building, relative to the builder's snapshot
+  WordCounts pending;
+  WordIndexBuilderPtr builder;
+
+  void build(TextBuffer &buffer);
+  bool update();
+  void clear();
+  bool is_ready();
+
+  void add_line(const std::u16string &line, int delta);
+};
+
+// Words of every open document, with the number of documents holding each.
+// Readers may query from any thread, documents update it from the ui thread.
+class CompletionIndex {
+public:
+  CompletionIndex();
+
+  static CompletionIndex *instance();
+
+  std::shared_mutex mutex;
+  WordCounts documents;
+  // bumped whenever a word appears or disappears; results computed at the
+  // same generation are still exact
+  std::atomic<unsigned> generation;
+  std::atomic<size_t> bytes;
+  // words that appeared since generation log_start, so that results of an
+  // older generation can be brought up to date; a whole document coming or
+  // going restarts it
+  std::deque<std::u16string> added;
+  unsigned log_start;
+
+  void add(const std::u16string &word);
+  void remove(const std::u16string &word);
+  void add_document(const WordCounts &words);
+  void remove_document(const WordCounts &words);
+
+  size_t size();
+  size_t memory();
+
+  // run on the executor, a full query visits every word
+  std::vector<FuzzyMatch> query(const std::u16string &prefix,
+                                const std::atomic<bool> *cancelled = nullptr);
+  bool refine(const std::u16string &prefix,
+              const std::vector<FuzzyMatch> &candidates, unsigned since,
+              std::vector<FuzzyMatch> &res,
+              const std::atomic<bool> *cancelled = nullptr);
+
+private:
+  void log_added(const std::u16string &word);
+  void restart_log();
+};
+
+#endif // TE_WORDINDEX_H
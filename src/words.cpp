@@ -0,0 +1,111 @@
+#include "words.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+bool is_word_character(char16_t c) {
+  return (c >= u'a' && c <= u'z') || (c >= u'A' && c <= u'Z') ||
+         (c >= u'0' && c <= u'9') || c == u'_';
+}
+
+//---------------
+// class masks
+// each kernel classifies one fixed-size block and returns one bit per code
+// unit, set for word characters
+//---------------
+
+#if defined(__SSE2__)
+
+// lo <= v <= lo + n, unsigned
+static inline __m128i in_range(__m128i v, short lo, short n) {
+  __m128i d = _mm_sub_epi16(v, _mm_set1_epi16(lo));
+  return _mm_cmpeq_epi16(_mm_subs_epu16(d, _mm_set1_epi16(n)),
+                         _mm_setzero_si128());
+}
+
+static inline __m128i word_class(__m128i v) {
+  // folding 0x20 maps upper case onto lower case and nothing else into a-z
+  __m128i res = in_range(_mm_or_si128(v, _mm_set1_epi16(0x20)), 'a', 25);
+  res = _mm_or_si128(res, in_range(v, '0', 9));
+  return _mm_or_si128(res, _mm_cmpeq_epi16(v, _mm_set1_epi16('_')));
+}
+
+#endif
+
+#if defined(__AVX2__)
+
+#define WORD_BLOCK 16
+
+static inline unsigned word_mask(const char16_t *src) {
+  __m128i lo = word_class(_mm_loadu_si128((const __m128i *)src));
+  __m128i hi = word_class(_mm_loadu_si128((const __m128i *)(src + 8)));
+  return (unsigned)_mm_movemask_epi8(_mm_packs_epi16(lo, hi));
+}
+
+#elif defined(__SSE2__)
+
+#define WORD_BLOCK 8
+
+static inline unsigned word_mask(const char16_t *src) {
+  __m128i v = word_class(_mm_loadu_si128((const __m128i *)src));
+  return (unsigned)_mm_movemask_epi8(_mm_packs_epi16(v, v)) & 0xff;
+}
+
+#else
+
+#define WORD_BLOCK 8
+
+static inline unsigned word_mask(const char16_t *src) {
+  unsigned res = 0;
+  for (int i = 0; i < WORD_BLOCK; i++) {
+    res |= (unsigned)is_word_character(src[i]) << i;
+  }
+  return res;
+}
+
+#endif
+
+//---------------
+// tokenizer
+//---------------
+
+void tokenize_words(const char16_t *text, size_t length, int row,
+                    std::vector<Range> &words) {
+  const unsigned full = (1u << WORD_BLOCK) - 1;
+  bool in_word = false;
+  int start = 0;
+  size_t i = 0;
+  for (; i + WORD_BLOCK <= length; i += WORD_BLOCK) {
+    unsigned mask = word_mask(text + i);
+    if (mask == (in_word ? full : 0)) {
+      continue;
+    }
+    // a set bit marks a unit whose class differs from the one before it
+    unsigned edges = (mask ^ ((mask << 1) | (in_word ? 1 : 0))) & full;
+    while (edges) {
+      int at = (int)i + __builtin_ctz(edges);
+      if (in_word) {
+        words.push_back(Range{Point(row, start), Point(row, at)});
+      } else {
+        start = at;
+      }
+      in_word = !in_word;
+      edges &= edges - 1;
+    }
+  }
+  for (; i < length; i++) {
+    if (is_word_character(text[i]) == in_word) {
+      continue;
+    }
+    if (in_word) {
+      words.push_back(Range{Point(row, start), Point(row, i)});
+    } else {
+      start = (int)i;
+    }
+    in_word = !in_word;
+  }
+  if (in_word) {
+    words.push_back(Range{Point(row, start), Point(row, length)});
+  }
+}
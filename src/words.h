@@ -0,0 +1,15 @@
+#ifndef TE_WORDS_H
+#define TE_WORDS_H
+
+#include <core/range.h>
+#include <cstddef>
+#include <vector>
+
+// [a-zA-Z_0-9]
+bool is_word_character(char16_t c);
+
+// appends the word ranges of one line in a single pass, any line length
+void tokenize_words(const char16_t *text, size_t length, int row,
+                    std::vector<Range> &words);
+
+#endif // TE_WORDS_H
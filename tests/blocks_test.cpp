@@ -0,0 +1,151 @@
+#include "blocks.h"
+#include "document.h"
+#include "expect.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+// reference list, one entry per line, null until the line is materialized
+typedef std::vector<BlockPtr> Lines;
+
+static bool same(BlockList &blocks, Lines &lines) {
+  if (blocks.size() != (int)lines.size()) {
+    return false;
+  }
+  for (int i = 0; i < (int)lines.size(); i++) {
+    if (blocks.find(i) != lines[i]) {
+      return false;
+    }
+  }
+  int materialized = 0;
+  for (auto &b : lines) {
+    materialized += b ? 1 : 0;
+  }
+  return blocks.materialized() == materialized;
+}
+
+static void insert(BlockList &blocks, Lines &lines, int line, int count) {
+  blocks.insert(line, count);
+  lines.insert(lines.begin() + line, count, nullptr);
+}
+
+static void erase(BlockList &blocks, Lines &lines, int line, int count) {
+  blocks.erase(line, count);
+  lines.erase(lines.begin() + line, lines.begin() + line + count);
+}
+
+static void at(BlockList &blocks, Lines &lines, int line) {
+  BlockPtr block = blocks.at(line);
+  if (!lines[line]) {
+    lines[line] = block;
+  }
+}
+
+// a large lazy run is split into chunks around the lines asked for
+static void test_split() {
+  BlockList blocks;
+  Lines lines;
+  insert(blocks, lines, 0, 100000);
+  expect(blocks.size() == 100000, "lazy insert size");
+  expect(blocks.materialized() == 0, "lazy insert allocates nothing");
+
+  at(blocks, lines, 50000);
+  at(blocks, lines, 0);
+  at(blocks, lines, 99999);
+  expect(blocks.materialized() == 3, "split materializes one line each");
+  expect(same(blocks, lines), "split keeps lines");
+  expect(blocks.at(50000) == lines[50000], "split block is stable");
+  expect(blocks.at(-1) == nullptr && blocks.at(100000) == nullptr,
+         "out of range");
+}
+
+// splices move materialized blocks along with their lines
+static void test_splice() {
+  BlockList blocks;
+  Lines lines;
+  insert(blocks, lines, 0, 1000);
+  for (int i = 0; i < 1000; i += 7) {
+    at(blocks, lines, i);
+  }
+
+  insert(blocks, lines, 500, 3);
+  insert(blocks, lines, 0, 10);
+  insert(blocks, lines, blocks.size(), 10);
+  expect(same(blocks, lines), "insert moves blocks");
+
+  erase(blocks, lines, 200, 300);
+  erase(blocks, lines, 0, 5);
+  expect(same(blocks, lines), "erase moves blocks");
+
+  // joins the runs on both sides of the erased range
+  erase(blocks, lines, 100, blocks.size() - 200);
+  expect(same(blocks, lines), "erase joins");
+
+  // erasing past the end stops at the end
+  blocks.erase(150, 1000);
+  lines.resize(150);
+  expect(same(blocks, lines), "erase clamps");
+
+  blocks.clear();
+  expect(blocks.size() == 0 && blocks.materialized() == 0, "clear");
+}
+
+// moved blocks keep their state, make_dirty only touches lines from line on
+static void test_dirty() {
+  BlockList blocks;
+  Lines lines;
+  insert(blocks, lines, 0, 10);
+  for (int i = 0; i < 10; i++) {
+    at(blocks, lines, i);
+    lines[i]->dirty = false;
+  }
+  insert(blocks, lines, 5, 2);
+  bool clean = true;
+  for (auto &b : lines) {
+    clean = clean && (!b || !b->dirty);
+  }
+  expect(clean, "splice keeps blocks clean");
+
+  blocks.make_dirty(6);
+  for (int i = 0; i < (int)lines.size(); i++) {
+    if (lines[i]) {
+      expect(lines[i]->dirty == (i >= 6), "make_dirty from line");
+    }
+  }
+}
+
+static void test_random() {
+  srand(7);
+  BlockList blocks;
+  Lines lines;
+  bool ok = true;
+  for (int i = 0; i < 5000; i++) {
+    int size = lines.size();
+    int op = rand() % 3;
+    if (op == 0 || size == 0) {
+      insert(blocks, lines, rand() % (size + 1), 1 + rand() % 600);
+    } else if (op == 1) {
+      int line = rand() % size;
+      erase(blocks, lines, line, 1 + rand() % (size - line));
+    } else {
+      at(blocks, lines, rand() % size);
+    }
+    if (lines.size() > 20000) {
+      erase(blocks, lines, 0, 10000);
+    }
+    if (i % 50 == 0) {
+      ok = ok && same(blocks, lines);
+    }
+  }
+  expect(ok && same(blocks, lines), "random splices");
+}
+
+int main(int argc, char **argv) {
+  test_split();
+  test_splice();
+  test_dirty();
+  test_random();
+  return report();
+}
@@ -0,0 +1,93 @@
+#include "channel.h"
+#include "expect.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <memory>
+#include <thread>
+
+static void test_segments() {
+  Channel<int> channel;
+  int item;
+  expect(!channel.pop(item), "empty");
+
+  // fill exactly one segment, then cross into the next
+  for (int i = 0; i < CHANNEL_SEGMENT; i++) {
+    channel.push(i);
+  }
+  expect(channel.head == channel.tail, "one full segment");
+  channel.push(CHANNEL_SEGMENT);
+  expect(channel.head != channel.tail, "next segment linked");
+
+  bool ok = true;
+  for (int i = 0; i <= CHANNEL_SEGMENT; i++) {
+    ok = ok && channel.pop(item) && item == i;
+  }
+  expect(ok, "order across a segment");
+  expect(channel.head == channel.tail, "drained segment freed");
+  expect(!channel.pop(item), "empty again");
+
+  // interleaved around several boundaries
+  int pushed = 0, popped = 0;
+  ok = true;
+  for (int round = 0; round < 10 * CHANNEL_SEGMENT; round++) {
+    for (int i = 0; i < 3; i++) {
+      channel.push(pushed++);
+    }
+    for (int i = 0; i < 2; i++) {
+      ok = ok && channel.pop(item) && item == popped++;
+    }
+  }
+  while (channel.pop(item)) {
+    ok = ok && item == popped++;
+  }
+  expect(ok && popped == pushed, "interleaved");
+}
+
+// items are moved out, nothing is left holding them
+static void test_ownership() {
+  std::shared_ptr<int> value = std::make_shared<int>(7);
+  {
+    Channel<std::shared_ptr<int>> channel;
+    for (int i = 0; i < CHANNEL_SEGMENT * 2 + 1; i++) {
+      channel.push(value);
+    }
+    std::shared_ptr<int> item;
+    for (int i = 0; i < CHANNEL_SEGMENT + 1; i++) {
+      channel.pop(item);
+    }
+    item = nullptr;
+    expect(value.use_count() == CHANNEL_SEGMENT + 1, "popped items released");
+  }
+  expect(value.use_count() == 1, "pending items released with the channel");
+}
+
+static void test_threads() {
+  Channel<int> channel;
+  const int count = 1000000;
+  std::thread producer([&channel] {
+    for (int i = 0; i < count; i++) {
+      channel.push(i);
+    }
+  });
+  int expected = 0;
+  bool ok = true;
+  int item;
+  while (expected < count) {
+    if (channel.pop(item)) {
+      ok = ok && item == expected;
+      expected++;
+    }
+  }
+  producer.join();
+  expect(ok, "producer order kept");
+  expect(!channel.pop(item), "nothing extra");
+}
+
+int main(int argc, char **argv) {
+  test_segments();
+  test_ownership();
+  test_threads();
+  return report();
+}
@@ -0,0 +1,116 @@
+#include "wordindex.h"
+#include "expect.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <string>
+
+static bool same(std::vector<FuzzyMatch> a, std::vector<FuzzyMatch> b) {
+  std::sort(a.begin(), a.end(), compare_fuzzy_match);
+  std::sort(b.begin(), b.end(), compare_fuzzy_match);
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i++) {
+    if (a[i].text != b[i].text || a[i].score != b[i].score) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool contains(const std::vector<FuzzyMatch> &matches,
+                     const std::u16string &word) {
+  for (auto &m : matches) {
+    if (m.text == word) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// replaces a row the way an edit does, forwarding words to the shared index
+static void retype(WordIndex &index, std::u16string &line,
+                   const std::u16string &text) {
+  index.add_line(line, -1);
+  line = text;
+  index.add_line(line, 1);
+}
+
+// typing "ren" -> "rend" -> "rende" changes the word at the cursor on every
+// keystroke, the cached ancestor must still be refined rather than requeried
+static void test_typing() {
+  CompletionIndex *completions = CompletionIndex::instance();
+  WordIndex index;
+  WordCounts words = {{u"render", 1},   {u"renderer", 1}, {u"rename", 1},
+                      {u"rendition", 1}, {u"reindent", 1}, {u"other", 1}};
+  index.counts = words;
+  index.state = WordIndex::State::Ready;
+  completions->add_document(words);
+
+  std::u16string line = u"  ren";
+  index.add_line(line, 1);
+  unsigned generation = completions->generation;
+  std::vector<FuzzyMatch> ren = completions->query(u"ren");
+  expect(contains(ren, u"rename"), "ren matches rename");
+
+  retype(index, line, u"  rend");
+  expect(completions->generation != generation, "typing bumps generation");
+  std::vector<FuzzyMatch> rend;
+  expect(completions->refine(u"rend", ren, generation, rend), "rend refines");
+  expect(same(rend, completions->query(u"rend")), "rend refined as queried");
+  expect(!contains(rend, u"rend"), "rend skips itself");
+
+  // a word typed elsewhere after the ancestor was answered
+  generation = completions->generation;
+  std::u16string other = u"rendering";
+  index.add_line(other, 1);
+  retype(index, line, u"  rende");
+  std::vector<FuzzyMatch> rende;
+  expect(completions->refine(u"rende", rend, generation, rende),
+         "rende refines");
+  expect(contains(rende, u"rendering"), "rende picks up new word");
+  expect(!contains(rende, u"rend"), "rende drops removed word");
+  expect(same(rende, completions->query(u"rende")),
+         "rende refined as queried");
+
+  index.add_line(other, -1);
+  index.add_line(line, -1);
+  index.clear();
+}
+
+// an ancestor older than the log falls back to a full query
+static void test_stale() {
+  CompletionIndex *completions = CompletionIndex::instance();
+  WordIndex index;
+  index.state = WordIndex::State::Ready;
+  unsigned generation = completions->generation;
+  std::vector<FuzzyMatch> res;
+  expect(completions->refine(u"ab", {}, generation, res), "fresh refines");
+
+  WordCounts words = {{u"abc", 1}};
+  completions->add_document(words);
+  res.clear();
+  expect(!completions->refine(u"ab", {}, generation, res),
+         "document load restarts log");
+
+  generation = completions->generation;
+  for (int i = 0; i < 5000; i++) {
+    std::u16string word = u"w" + std::u16string(1, u'a' + i % 26) +
+                          std::u16string(1, u'a' + i / 26 % 26) +
+                          std::u16string(1, u'a' + i / 676);
+    index.add_line(word, 1);
+    index.add_line(word, -1);
+  }
+  res.clear();
+  expect(!completions->refine(u"ab", {}, generation, res), "log overflow");
+  completions->remove_document(words);
+}
+
+int main(int argc, char **argv) {
+  test_typing();
+  test_stale();
+  return report();
+}
@@ -0,0 +1,26 @@
+#ifndef TE_TESTS_EXPECT_H
+#define TE_TESTS_EXPECT_H
+
+#include <stdio.h>
+
+// Checks for the standalone tests: a failed expect is reported and the
+// test goes on, main returns report()
+static int failures = 0;
+
+static void expect(bool cond, const char *what) {
+  if (!cond) {
+    printf("FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+static int report() {
+  if (failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
+
+#endif // TE_TESTS_EXPECT_H
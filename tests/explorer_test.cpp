@@ -1,3 +1,4 @@
+#include "executor.h"
 #include "files.h"
 #include <time.h>
 
@@ -16,8 +17,9 @@ int main(int argc, char **argv) {
   files->load("./libs");
 
   while (files->has_running_threads() || files->has_unconsumed_requests()) {
-    files->update();
     delay(50);
+    Executor::instance()->deliver();
+    files->update();
   }
 
   FileList tree;
@@ -0,0 +1,121 @@
+#include "folds.h"
+#include "cursor.h"
+#include "expect.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+static Cursor fold(int start, int end) {
+  Cursor c;
+  c.start = Point(start, 0);
+  c.end = Point(end, 0);
+  return c;
+}
+
+static void test_single() {
+  FoldIndex index;
+  std::vector<Cursor> folds;
+  index.build(folds);
+  expect(index.hidden_rows() == 0, "no folds");
+  expect(index.visual_to_buffer(7) == 7 && index.buffer_to_visual(7) == 7,
+         "no folds maps rows to themselves");
+
+  folds.push_back(fold(10, 20));
+  index.build(folds);
+  expect(index.hidden_rows() == 10, "first line stays visible");
+  expect(!index.is_hidden(10) && index.is_hidden(11) && index.is_hidden(20) &&
+             !index.is_hidden(21),
+         "hidden rows");
+  expect(index.hidden_before(15) == 4 && index.hidden_before(21) == 10,
+         "hidden before");
+  expect(index.hidden_after(10) == 10 && index.hidden_after(9) == 0,
+         "hidden after");
+  expect(index.buffer_to_visual(21) == 11 && index.visual_to_buffer(11) == 21,
+         "rows below the fold");
+  expect(index.visual_to_buffer(10) == 10, "fold line");
+  expect(index.visible_above(15) == 10 && index.visible_below(15) == 21,
+         "nearest visible rows");
+  expect(index.contains(Point(15, 3)) && index.contains(Point(20, 0)) &&
+             !index.contains(Point(20, 1)) && !index.contains(Point(9, 0)),
+         "contains");
+}
+
+// nested and overlapping folds merge, folds next to each other do not
+static void test_merge() {
+  FoldIndex index;
+  std::vector<Cursor> folds = {fold(18, 30), fold(10, 20), fold(12, 15)};
+  index.build(folds);
+  expect(index.hidden_rows() == 20, "overlapping folds merge");
+  expect(index.hidden_after(10) == 20, "merged span");
+
+  folds = {fold(9, 12), fold(5, 8)};
+  index.build(folds);
+  expect(index.hidden_rows() == 6, "adjacent folds");
+  expect(!index.is_hidden(9) && index.hidden_before(10) == 3,
+         "line between adjacent folds stays visible");
+  expect(index.visual_to_buffer(6) == 9, "adjacent folds mapping");
+
+  index.make_dirty();
+  expect(index.is_dirty(), "dirty");
+  index.build(folds);
+  expect(!index.is_dirty(), "rebuilt");
+}
+
+// against a plain per row table
+static void test_random() {
+  srand(11);
+  const int rows = 2000;
+  bool ok = true;
+  for (int round = 0; round < 50; round++) {
+    std::vector<Cursor> folds;
+    std::vector<bool> hidden(rows + 100, false);
+    int count = rand() % 40;
+    for (int i = 0; i < count; i++) {
+      int start = rand() % rows;
+      int end = start + rand() % 50;
+      folds.push_back(fold(start, end));
+      for (int r = start + 1; r <= end; r++) {
+        hidden[r] = true;
+      }
+    }
+    FoldIndex index;
+    index.build(folds);
+
+    int before = 0;
+    for (int row = 0; row < rows; row++) {
+      ok = ok && index.is_hidden(row) == hidden[row];
+      ok = ok && index.hidden_before(row) == before;
+      if (!hidden[row]) {
+        int after = 0;
+        while (hidden[row + 1 + after]) {
+          after++;
+        }
+        ok = ok && index.hidden_after(row) == after;
+        ok = ok && index.buffer_to_visual(row) == row - before;
+        ok = ok && index.visual_to_buffer(row - before) == row;
+      } else {
+        int above = row;
+        while (hidden[above]) {
+          above--;
+        }
+        int below = row;
+        while (hidden[below]) {
+          below++;
+        }
+        ok = ok && index.visible_above(row) == above;
+        ok = ok && index.visible_below(row) == below;
+      }
+      before += hidden[row] ? 1 : 0;
+    }
+  }
+  expect(ok, "random folds");
+}
+
+int main(int argc, char **argv) {
+  test_single();
+  test_merge();
+  test_random();
+  return report();
+}
@@ -0,0 +1,158 @@
+#include "fuzzy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#define BENCH_WORDS (500 * 1000)
+#define BENCH_ROUNDS 5
+#define BENCH_TOP 20
+
+// scalar subsequence scoring followed by a full sort, as completions did
+// before the top-k heap
+static std::vector<FuzzyMatch> naive_top(const std::u16string &query,
+                                         const std::vector<std::u16string> &words) {
+  FuzzyQuery q(query);
+  std::vector<FuzzyMatch> res;
+  for (auto &w : words) {
+    size_t j = 0;
+    for (size_t i = 0; i < w.size() && j < query.size(); i++) {
+      if (w[i] == q.lower[j] || w[i] == q.upper[j]) {
+        j++;
+      }
+    }
+    if (j < query.size()) {
+      continue;
+    }
+    res.push_back(FuzzyMatch{w, q.score(w)});
+  }
+  std::sort(res.begin(), res.end(), compare_fuzzy_match);
+  if (res.size() > BENCH_TOP) {
+    res.resize(BENCH_TOP);
+  }
+  return res;
+}
+
+static std::vector<FuzzyMatch> fuzzy_top(const std::u16string &query,
+                                         const std::vector<std::u16string> &words) {
+  FuzzyQuery q(query);
+  FuzzyTopK top(BENCH_TOP);
+  for (auto &w : words) {
+    int score = q.score(w);
+    if (top.accepts(score)) {
+      top.push(w, score);
+    }
+  }
+  return top.take();
+}
+
+static std::u16string join(const char **parts, int n, int count,
+                           char16_t separator, bool camel) {
+  std::u16string res;
+  for (int i = 0; i < count; i++) {
+    const char *p = parts[rand() % n];
+    if (i > 0 && separator) {
+      res += separator;
+    }
+    for (int j = 0; p[j]; j++) {
+      char16_t c = p[j];
+      if (camel && i > 0 && j == 0) {
+        c -= 32;
+      }
+      res += c;
+    }
+  }
+  return res;
+}
+
+// identifier-like vocabulary of snake and camel case words
+static std::vector<std::u16string> make_words() {
+  const char *parts[] = {"get",   "set",    "buffer", "cursor", "line",
+                         "text",  "index",  "node",   "parse",  "render",
+                         "block", "fold",   "undo",   "word",   "match",
+                         "range", "start",  "end",    "count",  "state",
+                         "doc",   "editor", "file",   "path",   "item"};
+  int n = sizeof(parts) / sizeof(parts[0]);
+  std::vector<std::u16string> res;
+  srand(1);
+  while (res.size() < BENCH_WORDS) {
+    bool camel = rand() % 2;
+    std::u16string w = join(parts, n, 1 + rand() % 4, camel ? 0 : u'_', camel);
+    w += (char16_t)(u'0' + rand() % 10);
+    res.push_back(w);
+  }
+  return res;
+}
+
+// file paths, longer candidates with few word parts matching
+static std::vector<std::u16string> make_paths() {
+  const char *parts[] = {"src",        "libs",     "tree",     "sitter",
+                         "superstring", "core",     "text",     "buffer",
+                         "include",    "tests",    "node",     "modules",
+                         "extensions", "themes",   "grammars", "json",
+                         "syntaxes",   "lib",      "bin",      "docs"};
+  int n = sizeof(parts) / sizeof(parts[0]);
+  std::vector<std::u16string> res;
+  srand(2);
+  while (res.size() < BENCH_WORDS / 2) {
+    res.push_back(join(parts, n, 3 + rand() % 6, u'/', false) + u".cpp");
+  }
+  return res;
+}
+
+template <typename F> static double measure(F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCH_ROUNDS; i++) {
+    f();
+  }
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+             .count() *
+         1000 / BENCH_ROUNDS;
+}
+
+static bool same(const std::vector<FuzzyMatch> &a,
+                 const std::vector<FuzzyMatch> &b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i++) {
+    if (a[i].text != b[i].text || a[i].score != b[i].score) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int bench(const char *set, const std::vector<std::u16string> &words,
+                 const std::vector<std::u16string> &queries) {
+  int failures = 0;
+  for (auto &query : queries) {
+    std::vector<FuzzyMatch> expected, actual;
+    double naive = measure([&] { expected = naive_top(query, words); });
+    double fuzzy = measure([&] { actual = fuzzy_top(query, words); });
+    bool ok = same(expected, actual);
+    if (!ok) {
+      failures++;
+    }
+    std::string name;
+    for (auto c : query) {
+      name += (char)c;
+    }
+    printf("%-6s %-8s %7.2f ms (naive %7.2f)  %zu matches%s\n", set,
+           name.c_str(), fuzzy, naive, actual.size(), ok ? "" : "  MISMATCH");
+  }
+  return failures;
+}
+
+int main(int argc, char **argv) {
+  int failures = bench("words", make_words(),
+                       {u"gbl", u"curLine", u"rndr", u"xyz", u"fold_st"});
+  failures += bench("paths", make_paths(),
+                    {u"stbuf", u"tsjson", u"xyz", u"extthm"});
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,122 @@
+#include "input.h"
+#include "expect.h"
+
+#include <curses.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+static std::vector<KeyEvent> decode(std::string bytes) {
+  InputDecoder input;
+  input.escape_wait = 0;
+  input.feed(bytes);
+  std::vector<KeyEvent> res;
+  KeyEvent key;
+  while (input.next(key)) {
+    res.push_back(key);
+  }
+  return res;
+}
+
+static void test_plain() {
+  std::vector<KeyEvent> keys = decode("ab\t\r\x7f\x01");
+  expect(keys.size() == 6, "plain count");
+  expect(keys[0].key == 'a' && keys[0].sequence == "", "plain a");
+  expect(keys[1].key == 'b', "plain b");
+  expect(keys[2].key == K_TAB && keys[2].sequence == "tab", "tab");
+  expect(keys[3].sequence == "enter", "enter");
+  expect(keys[4].sequence == "backspace", "backspace");
+  expect(keys[5].key == 'a' && keys[5].sequence == "ctrl+a", "ctrl+a");
+}
+
+static void test_escapes() {
+  std::vector<KeyEvent> keys =
+      decode("\x1b[A\x1bOB\x1b[3~\x1b[1;5C\x1b[1;2H\x1b[6~\x1b[2~");
+  expect(keys.size() == 7, "escape count");
+  expect(keys[0].key == KEY_UP && keys[0].sequence == "up", "up");
+  expect(keys[1].key == KEY_DOWN && keys[1].sequence == "down", "ss3 down");
+  expect(keys[2].key == KEY_DC && keys[2].sequence == "delete", "delete");
+  expect(keys[3].key == K_CTRL_RIGHT && keys[3].sequence == "ctrl+right",
+         "ctrl+right");
+  expect(keys[4].key == K_SHIFT_HOME && keys[4].sequence == "shift+home",
+         "shift+home");
+  expect(keys[5].key == K_PAGE_DOWN, "pagedown");
+  expect(keys[6].key == K_INSERT, "insert");
+}
+
+static void test_alt() {
+  std::vector<KeyEvent> keys = decode("\x1bx\x1bQ");
+  expect(keys.size() == 2, "alt count");
+  expect(keys[0].key == K_ALT_ && keys[0].sequence == "alt+x", "alt+x");
+  expect(keys[1].sequence == "alt+shift+q", "alt+shift+q");
+}
+
+// a lone escape at the end of the input is the escape key
+static void test_cut_short() {
+  std::vector<KeyEvent> keys = decode("a\x1b");
+  expect(keys.size() == 2, "lone escape count");
+  expect(keys[1].key == K_ESC && keys[1].sequence == "", "lone escape");
+
+  keys = decode("\x1b[1;");
+  expect(keys.size() == 1 && keys[0].key == K_ESC, "cut short csi");
+
+  keys = decode("\x1b[99Zq");
+  expect(keys.size() == 2 && keys[0].key == K_ESC, "unknown csi");
+  expect(keys[1].key == 'q', "after unknown csi");
+}
+
+// a burst decodes in one go
+static void test_burst() {
+  std::string bytes;
+  for (int i = 0; i < 1000; i++) {
+    bytes += "\x1b[B";
+  }
+  InputDecoder input;
+  input.escape_wait = 0;
+  input.feed(bytes);
+  KeyEvent key;
+  expect(input.next(key) && key.key == KEY_DOWN, "burst first");
+  expect(input.keys.size() == 999, "burst queued");
+  expect(input.pending(), "burst pending");
+}
+
+// a paste is one key, however it is split across reads
+static void test_paste() {
+  std::vector<KeyEvent> keys =
+      decode("a\x1b[200~if (x) {\r\tb\x1b[A;\r\n}\x1b[201~z");
+  expect(keys.size() == 3, "paste count");
+  expect(keys[1].key == K_PASTE && keys[1].sequence == "paste", "paste key");
+  expect(keys[1].text == "if (x) {\n\tb\x1b[A;\n}", "paste text");
+  expect(keys[2].key == 'z', "after paste");
+
+  InputDecoder input;
+  input.escape_wait = 0;
+  KeyEvent key;
+  input.feed("\x1b[200~first\rsec");
+  expect(!input.next(key), "paste waits for its end");
+  input.feed("ond\x1b[20");
+  expect(!input.next(key), "paste waits for the whole end marker");
+  input.feed("1~");
+  expect(input.next(key) && key.text == "first\nsecond", "split paste");
+  expect(!input.pending(), "split paste consumed");
+
+  // the start marker itself split across reads
+  input.feed("\x1b[20");
+  expect(!input.next(key), "paste start marker waits");
+  input.feed("0~text\x1b[201~");
+  expect(input.next(key) && key.key == K_PASTE && key.text == "text",
+         "split start marker");
+  expect(!input.pending(), "split start marker consumed");
+}
+
+int main(int argc, char **argv) {
+  test_plain();
+  test_escapes();
+  test_alt();
+  test_cut_short();
+  test_burst();
+  test_paste();
+  return report();
+}
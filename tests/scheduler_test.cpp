@@ -0,0 +1,132 @@
+#include "scheduler.h"
+#include "expect.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+static void sleep_ms(int ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// most urgent priority first, then earliest deadline
+static void test_order() {
+  Scheduler scheduler;
+  std::vector<std::string> ran;
+  int owner;
+  auto task = [&ran](std::string name) {
+    return [&ran, name] {
+      ran.push_back(name);
+      return name == "normal";
+    };
+  };
+  scheduler.schedule(&owner, "low", 0, Scheduler::Low, task("low"));
+  scheduler.schedule(&owner, "normal", 0, Scheduler::Normal, task("normal"));
+  scheduler.schedule(&owner, "high", 0, Scheduler::High, task("high"));
+  scheduler.schedule(&owner, "early", 0, Scheduler::Normal, task("early"));
+  // pushed out past the other normal task
+  scheduler.schedule(&owner, "early", 1, Scheduler::Normal, task("early"));
+  sleep_ms(2);
+
+  expect(scheduler.next_due() == 0, "due now");
+  expect(scheduler.run(), "redraw requested");
+  expect(ran == std::vector<std::string>({"high", "normal", "early", "low"}),
+         "priority then deadline");
+  expect(scheduler.next_due() == -1, "nothing left");
+}
+
+static void test_deadline() {
+  Scheduler scheduler;
+  int owner, other;
+  int count = 0;
+  scheduler.schedule(&owner, "later", 50, Scheduler::High, [&count] {
+    count++;
+    return false;
+  });
+  int due = scheduler.next_due();
+  expect(due > 0 && due <= 50, "next due rounds up to the deadline");
+  expect(!scheduler.run() && count == 0, "not due yet");
+  expect(scheduler.is_scheduled(&owner, "later"), "still scheduled");
+
+  sleep_ms(due + 5);
+  scheduler.run();
+  expect(count == 1 && !scheduler.is_scheduled(&owner, "later"), "ran once");
+
+  scheduler.schedule(&owner, "a", 0, Scheduler::Normal, [] { return false; });
+  scheduler.schedule(&other, "a", 0, Scheduler::Normal, [] { return false; });
+  scheduler.cancel(&owner);
+  expect(!scheduler.is_scheduled(&owner, "a") &&
+             scheduler.is_scheduled(&other, "a"),
+         "cancel by owner");
+
+  // a task may schedule another, which runs in the same pass
+  scheduler.tasks.clear();
+  scheduler.schedule(&owner, "first", 0, Scheduler::Normal,
+                     [&scheduler, &owner, &count] {
+                       scheduler.schedule(&owner, "second", 0,
+                                          Scheduler::Normal, [&count] {
+                                            count++;
+                                            return false;
+                                          });
+                       return false;
+                     });
+  scheduler.run();
+  expect(count == 2 && scheduler.tasks.size() == 0, "chained task");
+}
+
+// due tasks stop once the budget is spent and wait for the next run
+static void test_budget() {
+  Scheduler scheduler;
+  scheduler.budget = 5;
+  int owner[10];
+  int count = 0;
+  for (int i = 0; i < 10; i++) {
+    scheduler.schedule(&owner[i], "slow", 0, Scheduler::Normal, [&count] {
+      sleep_ms(2);
+      count++;
+      return false;
+    });
+  }
+  scheduler.run();
+  expect(count >= 1 && count <= 3, "budget stops the run");
+  expect((int)scheduler.tasks.size() == 10 - count, "the rest wait");
+  expect(scheduler.next_due() == 0, "the rest are still due");
+
+  while (scheduler.tasks.size() > 0) {
+    scheduler.run();
+  }
+  expect(count == 10, "every task runs eventually");
+}
+
+static void test_highlight_rows() {
+  Scheduler scheduler;
+  scheduler.budget = 4;
+  scheduler.begin_frame();
+  sleep_ms(6);
+  expect(scheduler.highlight_rows() == SCHEDULER_MIN_HIGHLIGHT_ROWS,
+         "spent frame still makes progress");
+
+  for (int i = 0; i < 50; i++) {
+    scheduler.measure_highlight(1000, 0.001);
+  }
+  scheduler.begin_frame();
+  expect(scheduler.highlight_rows() == SCHEDULER_MAX_HIGHLIGHT_ROWS,
+         "cheap rows capped");
+
+  double cost = scheduler.row_cost;
+  scheduler.measure_highlight(0, 100);
+  expect(scheduler.row_cost == cost, "empty measurement ignored");
+  scheduler.measure_highlight(1, 100);
+  expect(scheduler.row_cost > cost, "slow rows raise the cost");
+}
+
+int main(int argc, char **argv) {
+  test_order();
+  test_deadline();
+  test_budget();
+  test_highlight_rows();
+  return report();
+}
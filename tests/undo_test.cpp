@@ -0,0 +1,160 @@
+#include "undo.h"
+#include "expect.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+// a single line of text edited through the journal, the way Document
+// applies undo and redo
+class Text {
+public:
+  std::u16string text;
+  UndoJournal journal;
+
+  void record(int start, int length, const std::u16string &insert) {
+    Range range{Point(0, start), Point(0, start + length)};
+    journal.record(range, text.substr(start, length), insert);
+    text.replace(start, length, insert);
+  }
+
+  void edit(int start, int length, const std::u16string &insert) {
+    journal.clear_redo();
+    record(start, length, insert);
+    journal.commit();
+  }
+
+  void type(const std::u16string &characters) {
+    for (auto c : characters) {
+      edit(text.size(), 0, std::u16string(1, c));
+    }
+  }
+
+  bool undo() {
+    std::vector<UndoChange> changes;
+    if (!journal.pop(changes)) {
+      return false;
+    }
+    std::vector<UndoChange> undone;
+    for (auto &c : changes) {
+      int start = c.range.start.column;
+      int length = c.range.end.column - start;
+      std::u16string current = text.substr(start, length);
+      text.replace(start, length, c.old_text);
+      undone.push_back(UndoChange{
+          Range{c.range.start, Point(0, start + c.old_text.size())}, current});
+    }
+    journal.push_redo(undone);
+    return true;
+  }
+
+  bool redo() {
+    std::vector<UndoChange> changes;
+    if (!journal.pop_redo(changes)) {
+      return false;
+    }
+    for (auto &c : changes) {
+      int start = c.range.start.column;
+      record(start, c.range.end.column - start, c.old_text);
+    }
+    journal.commit();
+    return true;
+  }
+};
+
+static void test_round_trip() {
+  Text t;
+  t.edit(0, 0, u"hello world");
+  t.edit(6, 5, u"there");
+  // one entry made of two edits, back to front
+  t.record(6, 0, u"out ");
+  t.record(0, 5, u"hi");
+  t.journal.commit();
+  expect(t.text == u"hi out there", "edits");
+  expect(t.journal.size() == 3, "three entries");
+
+  expect(t.undo() && t.text == u"hello there", "undo both edits of an entry");
+  expect(t.undo() && t.text == u"hello world", "undo replace");
+  expect(t.undo() && t.text == u"", "undo insert");
+  expect(!t.undo(), "nothing left to undo");
+
+  expect(t.redo() && t.text == u"hello world", "redo insert");
+  expect(t.redo() && t.text == u"hello there", "redo replace");
+  expect(t.redo() && t.text == u"hi out there", "redo entry");
+  expect(!t.redo(), "nothing left to redo");
+
+  t.undo();
+  t.edit(0, 0, u">");
+  expect(!t.redo(), "an edit clears redo");
+  expect(t.undo() && t.text == u"hello there", "undo after redo cleared");
+}
+
+// typed characters fold into one entry until a word ends
+static void test_coalesce() {
+  Text t;
+  t.type(u"abc def");
+  expect(t.journal.size() == 2, "typing coalesces per word");
+  expect(t.undo() && t.text == u"abc ", "undo word");
+  expect(t.undo() && t.text == u"", "undo first word");
+  expect(t.redo() && t.redo() && t.text == u"abc def", "redo words");
+
+  t.journal.seal();
+  t.type(u"g");
+  expect(t.journal.size() == 3, "sealed entries are not extended");
+
+  Text n;
+  n.type(u"ab");
+  n.edit(n.text.size(), 0, u"\n");
+  n.type(u"c");
+  expect(n.journal.size() == 3, "newline breaks the run");
+}
+
+// under a cap the oldest entries go, the rest still round trip
+static void test_cap() {
+  Text t;
+  t.journal.limit = 512 * 1024;
+  std::vector<std::u16string> states = {t.text};
+  for (int i = 0; i < 40; i++) {
+    t.edit(0, t.text.size(), std::u16string(20000 + i, u'a' + i % 26));
+    states.push_back(t.text);
+  }
+  expect(t.journal.evicted() > 0, "oldest entries evicted");
+  expect(t.journal.memory() <= t.journal.limit, "journal fits its limit");
+  expect(t.journal.evicted() + t.journal.size() == 40, "entries accounted");
+
+  size_t kept = t.journal.size();
+  size_t undone = 0;
+  bool ok = true;
+  while (t.undo()) {
+    undone++;
+    ok = ok && t.text == states[40 - undone];
+  }
+  expect(ok && undone > 0, "undo under the cap");
+  expect(t.journal.memory() <= t.journal.limit, "redo counted in the limit");
+  expect(undone == kept, "undoing keeps the entries still to be undone");
+
+  size_t redone = 0;
+  while (t.redo()) {
+    redone++;
+    ok = ok && t.text == states[40 - undone + redone];
+  }
+  expect(ok && redone > 0, "redo under the cap");
+  expect(t.journal.memory() <= t.journal.limit, "still fits after redo");
+
+  // a single entry larger than the limit is still kept
+  Text big;
+  big.journal.limit = 1024;
+  big.edit(0, 0, std::u16string(100000, u'x'));
+  big.edit(0, big.text.size(), u"y");
+  expect(big.journal.size() == 1, "newest entry kept");
+  expect(big.undo() && big.text.size() == 100000, "newest entry undone");
+}
+
+int main(int argc, char **argv) {
+  test_round_trip();
+  test_coalesce();
+  test_cap();
+  return report();
+}
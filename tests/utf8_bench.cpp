@@ -0,0 +1,87 @@
+#include "utf8.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <string>
+
+#define BENCH_SIZE (32 * 1024 * 1024)
+#define BENCH_ROUNDS 3
+
+// the transcoders as they were before the vectorized kernels
+static std::string naive_to_utf8(const std::u16string &text) {
+  std::string res;
+  for (auto c : text) {
+    char tmp[5];
+    codepoint_to_utf8(c, (char *)tmp);
+    res += tmp;
+  }
+  return res;
+}
+
+static std::u16string naive_to_utf16(const std::string &text) {
+  std::u16string res;
+  char *p = (char *)text.c_str();
+  while (*p) {
+    unsigned cp;
+    p = (char *)utf8_to_codepoint(p, &cp);
+    res += (char16_t)cp;
+  }
+  return res;
+}
+
+// mostly code-like ascii with one non-ascii character every `every` units
+static std::u16string make_text(int every) {
+  std::u16string res;
+  res.reserve(BENCH_SIZE);
+  srand(1);
+  while (res.size() < BENCH_SIZE) {
+    if (every && rand() % every == 0) {
+      res += (char16_t)(0x400 + rand() % 0x100);
+    } else if (rand() % 60 == 0) {
+      res += u'\n';
+    } else {
+      res += (char16_t)(0x20 + rand() % 0x5f);
+    }
+  }
+  return res;
+}
+
+template <typename F> static double measure(F f, size_t bytes) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < BENCH_ROUNDS; i++) {
+    f();
+  }
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  return (double)bytes * BENCH_ROUNDS / elapsed / (1024 * 1024);
+}
+
+static void bench(const char *name, int every) {
+  std::u16string text = make_text(every);
+  std::string utf8 = u16string_to_string(text);
+  size_t sink = 0;
+
+  double naive_out = measure([&] { sink += naive_to_utf8(text).size(); },
+                             utf8.size());
+  double simd_out = measure([&] { sink += u16string_to_string(text).size(); },
+                            utf8.size());
+  double naive_in = measure([&] { sink += naive_to_utf16(utf8).size(); },
+                            utf8.size());
+  double simd_in = measure([&] { sink += string_to_u16string(utf8).size(); },
+                           utf8.size());
+
+  printf("%-10s to utf-8 %8.1f MB/s (naive %7.1f)  to utf-16 %8.1f MB/s "
+         "(naive %7.1f)  [%zu]\n",
+         name, simd_out, naive_out, simd_in, naive_in, sink % 10);
+}
+
+int main(int argc, char **argv) {
+  bench("ascii", 0);
+  bench("1/100", 100);
+  bench("1/10", 10);
+  bench("1/2", 2);
+  return 0;
+}
@@ -0,0 +1,145 @@
+#include "utf8.h"
+#include "expect.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+
+// reference encoder, one code point at a time
+static std::string reference_utf8(const std::u16string &text) {
+  std::string res;
+  for (size_t i = 0; i < text.size(); i++) {
+    uint32_t cp = text[i];
+    if (cp >= 0xd800 && cp <= 0xdbff && i + 1 < text.size() &&
+        text[i + 1] >= 0xdc00 && text[i + 1] <= 0xdfff) {
+      cp = 0x10000 + ((cp - 0xd800) << 10) + (text[++i] - 0xdc00);
+    } else if (cp >= 0xd800 && cp <= 0xdfff) {
+      cp = 0xfffd;
+    }
+    char tmp[5];
+    codepoint_to_utf8(cp, tmp);
+    res += tmp;
+  }
+  return res;
+}
+
+static void test_basic() {
+  expect(u16string_to_string(u"") == "", "empty to utf-8");
+  expect(string_to_u16string("") == u"", "empty to utf-16");
+  expect(u16string_to_string(u"hello") == "hello", "ascii to utf-8");
+  expect(string_to_u16string("hello") == u"hello", "ascii to utf-16");
+  expect(u16string_to_string(u"café") == "caf\xc3\xa9", "2 byte");
+  expect(u16string_to_string(u"€") == "\xe2\x82\xac", "3 byte");
+  expect(u16string_to_string(u"\U0001f600") == "\xf0\x9f\x98\x80",
+         "surrogate pair to 4 byte");
+  expect(string_to_u16string("\xf0\x9f\x98\x80") == u"\U0001f600",
+         "4 byte to surrogate pair");
+  expect(string_to_u16string(std::string("a\0b", 3)) ==
+             std::u16string(u"a\0b", 3),
+         "embedded nul");
+}
+
+static void test_malformed() {
+  std::u16string lone_high = u"a";
+  lone_high += (char16_t)0xd83d;
+  lone_high += u"b";
+  expect(u16string_to_string(lone_high) == "a\xef\xbf\xbd"
+                                           "b",
+         "lone high surrogate");
+
+  std::u16string lone_low;
+  lone_low += (char16_t)0xde00;
+  expect(u16string_to_string(lone_low) == "\xef\xbf\xbd",
+         "lone low surrogate");
+
+  expect(string_to_u16string("a\x80z") == u"a�z", "stray continuation");
+  expect(string_to_u16string("a\xe2\x82") == u"a�", "truncated");
+  expect(string_to_u16string("\xe2\x82z") == u"�z",
+         "interrupted sequence");
+  expect(string_to_u16string("\xc0\xaf") == u"��", "overlong");
+  expect(string_to_u16string("\xed\xa0\x80") == u"���",
+         "encoded surrogate");
+  expect(string_to_u16string("\xf4\x90\x80\x80") == u"����",
+         "beyond U+10FFFF");
+
+  // one U+FFFD per maximal subpart
+  expect(string_to_u16string("\xe0\x80\x80") == u"���", "overlong 3 byte");
+  expect(string_to_u16string("\xf0\x9f\x98z") == u"�z",
+         "truncated 4 byte");
+  expect(string_to_u16string("\xf0\x80\x80\x80") == u"����",
+         "overlong 4 byte");
+  expect(string_to_u16string("\xe1\x80\xc3\xa9") == u"�é",
+         "subpart then valid");
+  expect(string_to_u16string("\x61\xf1\x80\x80\xe1\x80\xc2\x62") ==
+             u"a���b",
+         "unicode table 3-8");
+}
+
+// non-ascii characters at every offset around the vector widths
+static void test_boundaries() {
+  const char16_t specials[] = {u'é', u'€', 0xd83d};
+  for (char16_t special : specials) {
+    for (int length = 1; length < 80; length++) {
+      for (int at = 0; at < length; at++) {
+        std::u16string text(length, u'x');
+        text[at] = special;
+        if (special == 0xd83d && at + 1 < length) {
+          text[at + 1] = 0xde00;
+        }
+        std::string utf8 = u16string_to_string(text);
+        if (utf8 != reference_utf8(text)) {
+          expect(false, "boundary to utf-8");
+          return;
+        }
+        if (utf8_length(text.data(), text.size()) != utf8.size()) {
+          expect(false, "boundary utf8_length");
+          return;
+        }
+        if (!(special == 0xd83d && at + 1 == length) &&
+            string_to_u16string(utf8) != text) {
+          expect(false, "boundary round trip");
+          return;
+        }
+      }
+    }
+  }
+}
+
+static void test_random() {
+  srand(1);
+  for (int n = 0; n < 2000; n++) {
+    std::u16string text;
+    int length = rand() % 300;
+    for (int i = 0; i < length; i++) {
+      switch (rand() % 6) {
+      case 0:
+        text += (char16_t)(0x80 + rand() % 0x780);
+        break;
+      case 1:
+        text += (char16_t)(0x800 + rand() % 0xd000);
+        break;
+      case 2:
+        text += (char16_t)(0xd800 + rand() % 0x400);
+        text += (char16_t)(0xdc00 + rand() % 0x400);
+        break;
+      default:
+        text += (char16_t)(0x20 + rand() % 0x5f);
+        break;
+      }
+    }
+    std::string utf8 = u16string_to_string(text);
+    if (utf8 != reference_utf8(text) || string_to_u16string(utf8) != text) {
+      expect(false, "random round trip");
+      return;
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  test_basic();
+  test_malformed();
+  test_boundaries();
+  test_random();
+  return report();
+}
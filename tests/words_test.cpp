@@ -0,0 +1,109 @@
+#include "words.h"
+#include "expect.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+
+static std::vector<Range> tokenize(const std::u16string &text) {
+  std::vector<Range> res;
+  tokenize_words(text.data(), text.size(), 3, res);
+  return res;
+}
+
+// reference tokenizer, one code unit at a time
+static std::vector<Range> reference_words(const std::u16string &text) {
+  std::vector<Range> res;
+  size_t i = 0;
+  while (i < text.size()) {
+    if (!is_word_character(text[i])) {
+      i++;
+      continue;
+    }
+    size_t start = i;
+    while (i < text.size() && is_word_character(text[i])) {
+      i++;
+    }
+    res.push_back(Range{Point(3, start), Point(3, i)});
+  }
+  return res;
+}
+
+static bool same(const std::vector<Range> &a, const std::vector<Range> &b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i++) {
+    if (a[i].start != b[i].start || a[i].end != b[i].end) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void test_basic() {
+  expect(tokenize(u"").size() == 0, "empty");
+  expect(tokenize(u"  ,; ").size() == 0, "no words");
+  std::vector<Range> words = tokenize(u"int foo_bar = x1+2;");
+  expect(words.size() == 4, "word count");
+  expect(words[1].start == Point(3, 4) && words[1].end == Point(3, 11),
+         "underscore joins");
+  expect(words[2].start == Point(3, 14) && words[2].end == Point(3, 16),
+         "digits");
+  expect(tokenize(u"caféx").size() == 2, "non-ascii splits");
+  // these only match the ascii classes after a careless fold or wrap
+  std::u16string wide = u"a";
+  wide += (char16_t)0x0141;
+  wide += (char16_t)0xff41;
+  wide += (char16_t)0x8030;
+  wide += u"b";
+  expect(tokenize(wide).size() == 2, "wide code units are separators");
+}
+
+// word edges at every offset around the vector widths
+static void test_boundaries() {
+  for (int length = 1; length < 70; length++) {
+    for (int at = 0; at < length; at++) {
+      std::u16string text(length, u'x');
+      text[at] = u' ';
+      expect(same(tokenize(text), reference_words(text)), "single gap");
+      std::u16string gaps(length, u'.');
+      gaps[at] = u'Z';
+      expect(same(tokenize(gaps), reference_words(gaps)), "single letter");
+    }
+  }
+}
+
+static void test_random() {
+  const char16_t alphabet[] = {u'a', u'Z', u'_', u'7', u' ', u'.',
+                               u'\t', u'é', u'@', u'[', u'`', u'{'};
+  srand(7);
+  for (int round = 0; round < 2000; round++) {
+    std::u16string text;
+    int length = rand() % 200;
+    for (int i = 0; i < length; i++) {
+      text += alphabet[rand() % (sizeof(alphabet) / sizeof(char16_t))];
+    }
+    expect(same(tokenize(text), reference_words(text)), "random text");
+  }
+}
+
+// no line length limit
+static void test_long_line() {
+  std::u16string text;
+  for (int i = 0; i < 100000; i++) {
+    text += u"ab1,";
+  }
+  std::vector<Range> words = tokenize(text);
+  expect(words.size() == 100000, "long line word count");
+  expect(words.back().end == Point(3, text.size() - 1), "long line end");
+}
+
+int main(int argc, char **argv) {
+  test_basic();
+  test_boundaries();
+  test_random();
+  test_long_line();
+  return report();
+}